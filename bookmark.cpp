@@ -37,8 +37,10 @@ Bookmark::Bookmark()
     ifstream inFile { m_bookmarkFile };
     char c;
     string command;
-    while (inFile >> c >> command)
-        m_bookmarks[c] = command;
+    while (inFile >> c >> command) {
+        m_bookmarks[c] = m_commands.size();
+        m_commands.push_back(command);
+    }
 }
 
 Bookmark::~Bookmark()
@@ -53,5 +55,5 @@ Bookmark::lookup(char letter)
     if (iter == end(m_bookmarks)) {
         return string();
     }
-    return iter->second;
+    return string(m_commands[iter->second]);
 }
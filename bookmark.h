@@ -26,9 +26,12 @@
 #ifndef BOOKMARK_H
 #define BOOKMARK_H
 
+#include <cstddef>
 #include <map>
 #include <string>
 
+#include "string_table.h"
+
 class Bookmark {
     public:
         Bookmark();
@@ -40,7 +43,8 @@ class Bookmark {
 
     private:
         std::string m_bookmarkFile;
-        std::map<char, std::string> m_bookmarks;
+        StringTable m_commands;
+        std::map<char, std::size_t> m_bookmarks;
 };
 
 #endif /* !BOOKMARK_H*/
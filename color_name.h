@@ -0,0 +1,55 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef COLOR_NAME_H
+#define COLOR_NAME_H
+
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Color specifications resolved without asking the X server: #rgb (with
+ * 1 to 4 hex digits per channel), rgb:r/g/b, and the names in the X11
+ * rgb.txt, which are matched ignoring case and spaces, as the server does.
+ */
+class ColorName {
+    public:
+        /* 16 bits per channel, as in the X protocol */
+        struct RGB {
+            uint16_t red;
+            uint16_t green;
+            uint16_t blue;
+        };
+
+        static bool parse(std::string_view spec, RGB& rgb);
+
+    private:
+        static bool parseHash(std::string_view spec, RGB& rgb);
+        static bool parseRgb(std::string_view spec, RGB& rgb);
+        static bool lookup(std::string_view name, RGB& rgb);
+};
+
+#endif /* !COLOR_NAME_H */
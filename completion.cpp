@@ -26,24 +26,167 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+#if defined(__has_include)
+#if __has_include(<sys/inotify.h>)
+#include <sys/inotify.h>
+#define HAVE_INOTIFY 1
+#endif
+#endif
+
+#include <cerrno>
 #include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <ctime>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <mutex>
+#include <queue>
 #include <stdexcept>
 #include <sstream>
+#include <thread>
 using namespace std;
 
 #include "completion.h"
+#include "fuzzy_matcher.h"
+#include "index_cache.h"
+#include "trace.h"
 #include "util.h"
 
-Completion::Completion()
+#ifdef HAVE_INOTIFY
+static constexpr uint32_t WatchMask {
+    IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR
+};
+#endif
+
+/*
+ * Whether a directory entry is an executable regular file. The entry is
+ * resolved relative to the directory's file descriptor, and d_type is used
+ * to skip anything that is obviously not a regular file without an extra
+ * system call. Only symbolic links and entries on file systems that don't
+ * fill d_type are stat'ed. The kernel decides on executability
+ * (supplementary groups, ACLs, ...) through faccessat(2).
+ */
+static bool
+isExecutable(int dfd, const char * name, unsigned char type)
 {
     struct stat sb;
-    uid_t uid { getuid() };
-    gid_t gid { getgid() };
 
+    switch (type) {
+        case DT_REG:
+            break;
+
+        case DT_LNK:
+        case DT_UNKNOWN:
+            /* follow links to find out what they point to */
+            TRACE_SYSCALLS(1);
+            if (fstatat(dfd, name, &sb, 0) == -1 || !S_ISREG(sb.st_mode)) {
+                return false;
+            }
+            break;
+
+        default:
+            return false;
+    }
+
+    TRACE_SYSCALLS(1);
+    return faccessat(dfd, name, X_OK, AT_EACCESS) == 0;
+}
+
+/* collect the executables in a directory */
+static void
+scanDirectory(const string& pathElem, StringTable& names)
+{
+    TRACE_PHASE("scan directory");
+
+    /* open the directory pointed to by path */
+    DIR * dirp { opendir(pathElem.c_str()) };
+    TRACE_SYSCALLS(1);
+    if (dirp == nullptr) {
+        return;
+    }
+    int dfd { dirfd(dirp) };
+
+    /* traverse directory */
+    struct dirent * dp;
+    while ((dp = readdir(dirp))) {
+        if (isExecutable(dfd, dp->d_name, dp->d_type)) {
+            names.push_back(dp->d_name);
+        }
+    }
+    closedir(dirp);
+    TRACE_SYSCALLS(1);
+
+    names.sort();
+}
+
+/*
+ * K-way merge of the sorted per-directory runs, dropping names that show
+ * up in more than one directory.
+ */
+static void
+mergeRuns(const vector<IndexCache::Dir>& dirs, StringTable& out)
+{
+    typedef pair<StringTable::const_iterator, StringTable::const_iterator> Run;
+    auto cmp = [] (const Run& a, const Run& b) { return *a.first > *b.first; };
+    priority_queue<Run, vector<Run>, decltype(cmp)> heap { cmp };
+
+    size_t total { 0 };
+    size_t bytes { 0 };
+    for (const auto& d : dirs) {
+        if (!d.names.empty()) {
+            heap.emplace(begin(d.names), end(d.names));
+            total += d.names.size();
+            bytes += d.names.dataSize();
+        }
+    }
+    out.reserve(out.size() + total, out.dataSize() + bytes);
+
+    while (!heap.empty()) {
+        Run r { heap.top() };
+        heap.pop();
+        if (out.empty() || out.back() != *r.first) {
+            out.push_back(*r.first);
+        }
+        if (++r.first != r.second) {
+            heap.push(r);
+        }
+    }
+}
+
+/*
+ * State shared with the indexing thread. The thread is detached, so it
+ * keeps its own reference and may outlive the Completion object.
+ */
+struct Completion::Index {
+    mutex lock;
+    condition_variable cond;
+    bool ready { false };
+    function<void()> onReady;
+    StringTable elements;
+    vector<uint64_t> masks; /* FuzzyMatcher::charMask() of each element */
+    unsigned long generation { 0 };
+};
+
+static vector<uint64_t>
+charMasks(const StringTable& elements)
+{
+    vector<uint64_t> masks;
+    masks.reserve(elements.size());
+    for (const auto& e : elements) {
+        masks.push_back(FuzzyMatcher::charMask(e));
+    }
+    return masks;
+}
+
+static vector<string>
+splitPath()
+{
     /* get PATH env */
     string path { Util::getEnv("PATH") };
 
@@ -56,82 +199,630 @@ Completion::Completion()
         pathElements.push_back(move(elem));
     }
 
-    for (const auto& pathElem : pathElements) {
+    return pathElements;
+}
+
+static void
+buildIndex(vector<string> pathElements, const string& cacheDir, bool rebuildIndex, bool verbose,
+        vector<IndexCache::Dir>& dirs, StringTable& elements, vector<uint64_t>& masks)
+{
+    IndexCache cache { cacheDir };
+    if (!rebuildIndex) {
+        TRACE_PHASE("load index cache");
+        cache.load();
+    }
+
+    vector<size_t> misses;
+    for (auto& pathElem : pathElements) {
+
+        IndexCache::Dir dir;
+        TRACE_SYSCALLS(1);
+        if (stat(pathElem.c_str(), &dir.sb) == -1 || !S_ISDIR(dir.sb.st_mode)) {
+            continue;
+        }
+
+        /* skip directories listed more than once */
+        auto same = [&dir] (const IndexCache::Dir& d) {
+            return d.sb.st_dev == dir.sb.st_dev && d.sb.st_ino == dir.sb.st_ino;
+        };
+        if (any_of(begin(dirs), end(dirs), same)) {
+            continue;
+        }
+
+        /* reuse the cached listing if the directory hasn't changed */
+        if (rebuildIndex || !cache.lookup(pathElem, dir.sb, dir.names)) {
+            misses.push_back(dirs.size());
+        }
+
+        dir.path = move(pathElem);
+        dirs.push_back(move(dir));
+    }
+
+    /* scan the directories that changed, each on its own thread */
+    if (misses.size() == 1) {
+        scanDirectory(dirs[misses[0]].path, dirs[misses[0]].names);
+    } else if (!misses.empty()) {
+        vector<thread> workers;
+        for (auto i : misses) {
+            auto& d = dirs[i];
+            workers.emplace_back([&d] { scanDirectory(d.path, d.names); });
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    /* nothing changed: the merged index is in the cache as well */
+    if (misses.empty() && cache.merged(dirs, elements, masks)) {
+        TRACE_PHASE("load merged index");
+    } else {
+        TRACE_PHASE("merge");
+        mergeRuns(dirs, elements);
+        masks = charMasks(elements);
+    }
+
+    if (!misses.empty()) {
+        TRACE_PHASE("save index cache");
+        cache.save(dirs, elements, masks);
+    }
+
+    if (verbose) {
+        cerr << "index: " << dirs.size() << " directories, "
+             << dirs.size() - misses.size() << " hits, " << misses.size() << " misses, "
+             << elements.size() << " executables in " << elements.capacityBytes() << " bytes" << endl;
+    }
+}
+
+Completion::Completion()
+    : m_index { make_shared<Index>() },
+      m_ready { false },
+      m_matchMode { Match_Prefix },
+      m_frecency { nullptr },
+      m_pos { string::npos },
+      m_scoredGeneration { 0 },
+      m_scoredVersion { 0 },
+      m_scoredValid { false }
+{ }
+
+Completion::~Completion()
+{
+    notify(nullptr);
+}
+
+/*
+ * Start building the index. The environment is read here, so that a
+ * missing $PATH or $HOME is reported to the caller rather than lost on
+ * the background thread.
+ */
+void
+Completion::start(bool rebuildIndex, bool verbose)
+{
+    thread(run, m_index, splitPath(), Util::getCacheDir(), rebuildIndex, verbose).detach();
+}
+
+void
+Completion::run(shared_ptr<Index> index, vector<string> pathElements, string cacheDir,
+        bool rebuildIndex, bool verbose)
+{
+#ifdef HAVE_INOTIFY
+    /* start watching before scanning, so no change can slip through */
+    int ifd { inotify_init1(IN_CLOEXEC) };
+    map<int, string> watches;
+    if (ifd != -1) {
+        TRACE_PHASE("watch directories");
+        TRACE_SYSCALLS(1 + pathElements.size());
+        for (const auto& p : pathElements) {
+            int wd { inotify_add_watch(ifd, p.c_str(), WatchMask) };
+            if (wd != -1) {
+                watches.emplace(wd, p);
+            }
+        }
+    }
+#endif
+
+    vector<IndexCache::Dir> dirs;
+    StringTable elements;
+    vector<uint64_t> masks;
+    {
+        TRACE_PHASE("build index");
+        buildIndex(move(pathElements), cacheDir, rebuildIndex, verbose, dirs, elements, masks);
+    }
+
+    {
+        lock_guard<mutex> guard { index->lock };
+        index->elements = move(elements);
+        index->masks = move(masks);
+        index->ready = true;
+        index->cond.notify_all();
+        if (index->onReady) {
+            index->onReady();
+        }
+    }
+
+#ifdef HAVE_INOTIFY
+    if (ifd != -1) {
+        watch(index, ifd, watches, dirs);
+        close(ifd);
+    }
+#endif
+}
+
+#ifdef HAVE_INOTIFY
+/* split a directory path into its parent and its own name */
+static pair<string, string>
+splitDir(string path)
+{
+    while (path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    auto slash = path.rfind('/');
+    if (slash == string::npos) {
+        return { ".", path };
+    }
+    return { slash == 0 ? "/" : path.substr(0, slash), path.substr(slash + 1) };
+}
+
+/*
+ * Apply changes to the $PATH directories to the index in place, until the
+ * watch descriptor goes away. A directory that is removed is looked for in
+ * its parent, and watched and scanned again once it is back.
+ */
+void
+Completion::watch(shared_ptr<Index> index, int ifd, const map<int, string>& watches,
+        vector<IndexCache::Dir>& dirs)
+{
+    /* map watch descriptors to (deduplicated) directories */
+    map<int, size_t> wdDirs;
+    for (const auto& w : watches) {
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            if (dirs[i].path == w.second) {
+                wdDirs.emplace(w.first, i);
+                break;
+            }
+        }
+    }
+
+    /* the parents of the directories that went away, and which ones */
+    map<int, vector<size_t>> wdParents;
+
+    auto inDir = [] (const IndexCache::Dir& d, string_view name) {
+        return binary_search(begin(d.names), end(d.names), name);
+    };
+
+    /* add or remove a name from a directory, and from the index if no other directory has it */
+    auto update = [&] (size_t di, string_view name, bool present) {
+        auto& names = dirs[di].names;
+        auto& elements = index->elements;
+        auto dpos = lower_bound(begin(names), end(names), name);
+        auto epos = lower_bound(begin(elements), end(elements), name);
+        bool indexed { epos != end(elements) && *epos == name };
+
+        if (present) {
+            if (dpos == end(names) || *dpos != name) {
+                names.insert(dpos - begin(names), name);
+            }
+            if (!indexed) {
+                index->masks.insert(begin(index->masks) + (epos - begin(elements)), FuzzyMatcher::charMask(name));
+                elements.insert(epos - begin(elements), name);
+                ++index->generation;
+            }
+        } else {
+            if (dpos != end(names) && *dpos == name) {
+                names.erase(dpos - begin(names));
+            }
+            bool elsewhere { false };
+            for (size_t i = 0; i < dirs.size() && !elsewhere; ++i) {
+                elsewhere = inDir(dirs[i], name);
+            }
+            if (indexed && !elsewhere) {
+                index->masks.erase(begin(index->masks) + (epos - begin(elements)));
+                elements.erase(epos - begin(elements));
+                ++index->generation;
+            }
+        }
+    };
+
+    /* look for a directory that went away in its parent */
+    auto lost = [&] (size_t di) {
+        auto parent = splitDir(dirs[di].path).first;
+        int wd { inotify_add_watch(ifd, parent.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD) };
+        if (wd != -1) {
+            wdParents[wd].push_back(di);
+        }
+    };
+
+    /* watch a directory again, if it is back */
+    auto rewatch = [&] (size_t di) {
+        int wd { inotify_add_watch(ifd, dirs[di].path.c_str(), WatchMask) };
+        if (wd == -1) {
+            return false;
+        }
+        wdDirs[wd] = di;
+        return true;
+    };
+
+    /* stop looking in a parent once all of its directories are back */
+    auto forgetParent = [&] (map<int, vector<size_t>>::iterator pw) {
+        if (wdDirs.find(pw->first) == end(wdDirs)) {
+            inotify_rm_watch(ifd, pw->first);
+        }
+        return wdParents.erase(pw);
+    };
+
+    /* what the events mean for the index, worked out before taking the
+     * lock, so that looking at the files doesn't hold up the UI */
+    struct Change {
+        size_t dir;
+        string name;
+        bool present;
+    };
+    vector<Change> changes;
 
-        /* open the directory pointed to by path */
-        DIR * dirp { opendir(pathElem.c_str()) };
-        if (dirp == nullptr) {
+    alignas(struct inotify_event) char buf[4096];
+    for (;;) {
+        ssize_t len { read(ifd, buf, sizeof(buf)) };
+        if (len == -1 && errno == EINTR) {
             continue;
         }
+        if (len <= 0) {
+            return;
+        }
+
+        bool overflow { false };
+        changes.clear();
+        const struct inotify_event * ev;
+        for (char * p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+            ev = reinterpret_cast<const struct inotify_event *>(p);
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
 
-        /* traverse directory */
-        struct dirent * dp;
-        while ((dp = readdir(dirp))) {
+            /* a directory that went away may be back */
+            auto pw = wdParents.find(ev->wd);
+            if (pw != end(wdParents) && ev->len != 0 && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                auto& lostDirs = pw->second;
+                for (auto i = begin(lostDirs); i != end(lostDirs); ) {
+                    if (splitDir(dirs[*i].path).second == ev->name && rewatch(*i)) {
+                        StringTable names;
+                        scanDirectory(dirs[*i].path, names);
+                        for (auto n : names) {
+                            changes.push_back({ *i, string(n), true });
+                        }
+                        i = lostDirs.erase(i);
+                    } else {
+                        ++i;
+                    }
+                }
+                if (lostDirs.empty()) {
+                    forgetParent(pw);
+                }
+            }
+
+            auto w = wdDirs.find(ev->wd);
+            if (w == end(wdDirs)) {
+                continue;
+            }
+            size_t di { w->second };
+
+            /* the directory itself went away */
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                StringTable names;
+                swap(names, dirs[di].names);
+                for (auto n : names) {
+                    changes.push_back({ di, string(n), false });
+                }
+                if (ev->mask & IN_MOVE_SELF) {
+                    inotify_rm_watch(ifd, ev->wd);
+                }
+                wdDirs.erase(w);
+                lost(di);
+                continue;
+            }
 
-            string currentPath { pathElem + "/" + dp->d_name };
-            /* create a 'path/file' string and check whether we can access meta-information */
-            if (stat(currentPath.c_str(), &sb) == -1) {
+            if (ev->len == 0) {
                 continue;
             }
 
-            /* a regular, executable file*/
-            if (((sb.st_mode & S_IFREG) == S_IFREG) &&
-                ((sb.st_uid == uid && (sb.st_mode & S_IXUSR) == S_IXUSR) ||
-                 (sb.st_gid == gid && (sb.st_mode & S_IXGRP) == S_IXGRP) ||
-                 ((sb.st_mode & S_IXOTH) == S_IXOTH)))
-            {
-                m_elements.push_back(dp->d_name);
+            string name { ev->name };
+            bool present { false };
+            if (!(ev->mask & (IN_DELETE | IN_MOVED_FROM))) {
+                string file { dirs[di].path + "/" + name };
+                present = isExecutable(AT_FDCWD, file.c_str(), DT_UNKNOWN);
             }
+            changes.push_back({ di, move(name), present });
+        }
+
+        if (!changes.empty()) {
+            lock_guard<mutex> guard { index->lock };
+            for (const auto& c : changes) {
+                update(c.dir, c.name, c.present);
+            }
+        }
+
+        /* events were lost: rescan everything, outside of the lock */
+        if (overflow) {
+            for (auto pw = begin(wdParents); pw != end(wdParents); ) {
+                auto& lostDirs = pw->second;
+                lostDirs.erase(remove_if(begin(lostDirs), end(lostDirs), rewatch), end(lostDirs));
+                pw = lostDirs.empty() ? forgetParent(pw) : std::next(pw);
+            }
+            for (auto& d : dirs) {
+                d.names.clear();
+                scanDirectory(d.path, d.names);
+            }
+            StringTable elements;
+            mergeRuns(dirs, elements);
+            auto masks = charMasks(elements);
+
+            lock_guard<mutex> guard { index->lock };
+            index->elements = move(elements);
+            index->masks = move(masks);
+            ++index->generation;
         }
-        closedir(dirp);
     }
+}
+#endif
 
-    sort(begin(m_elements), end(m_elements));
+void
+Completion::setMatchMode(MatchMode mode)
+{
+    m_matchMode = mode;
+    reset();
+}
 
-    /* initialize iterator to the begin */
-    m_iter = begin(m_elements);
+void
+Completion::setFrecency(const Frecency * frecency)
+{
+    m_frecency = frecency;
+    reset();
 }
 
-Completion::~Completion()
+void
+Completion::notify(function<void()> onReady)
 {
-    // nothing to do...
+    lock_guard<mutex> guard { m_index->lock };
+    m_index->onReady = move(onReady);
+}
+
+bool
+Completion::wait(chrono::milliseconds timeout)
+{
+    if (m_ready) {
+        return true;
+    }
+
+    unique_lock<mutex> guard { m_index->lock };
+    if (!m_index->cond.wait_for(guard, timeout, [this] { return m_index->ready; })) {
+        return false;
+    }
+
+    m_ready = true;
+    return true;
 }
 
 string
 Completion::next(string command)
 {
-    if (command.empty()) {
+    return cycle(move(command), true);
+}
+
+string
+Completion::prev(string command)
+{
+    return cycle(move(command), false);
+}
+
+string
+Completion::cycle(string command, bool forward)
+{
+    if (command.empty() || !m_ready) {
         return command;
     }
 
-    if (m_prefix.empty()) {
-        m_prefix = command;
+    /* the index might be updated live by the watcher thread */
+    lock_guard<mutex> guard { m_index->lock };
+    const auto& elements = m_index->elements;
+
+    /* the index changed under our feet: restart the cycle */
+    if (!m_cycle.prefix.empty() && m_cycle.generation != m_index->generation) {
+        findRange(m_cycle, m_cycle.prefix);
+        m_pos = string::npos;
     }
 
-    auto matchPrefix = [this] (string e) { return e.compare(0, m_prefix.size(), m_prefix) == 0; };
+    /* a new prefix: find the (contiguous) range of elements starting with it */
+    if (m_cycle.prefix.empty()) {
+        findRange(m_cycle, command);
+        m_pos = string::npos;
 
-    /* start from where we left off last time */
-    auto iter1 = find_if(m_iter, m_elements.cend(), matchPrefix);
-    if (iter1 != end(m_elements)) {
-        m_iter = iter1 + 1;
-        return *iter1;
+        /* complete up to the longest common prefix of all matches first */
+        if (m_matchMode == Match_Prefix && m_cycle.last - m_cycle.first > 1) {
+            const auto& a = elements[m_cycle.first];
+            const auto& b = elements[m_cycle.last - 1];
+            auto lcp = mismatch(begin(a), end(a), begin(b)).first - begin(a);
+            if (size_t(lcp) > command.size()) {
+                return string(a.substr(0, lcp));
+            }
+        }
     }
 
-    /* start over */
-    auto iter2 = find_if(begin(m_elements), end(m_elements), matchPrefix);
-    if (iter2 != begin(m_elements)) {
-        m_iter = iter2 + 1;
-        return *iter2;
+    size_t count { m_cycle.last - m_cycle.first };
+    if (count == 0) {
+        return command;
+    }
+
+    if (m_pos == string::npos) {
+        m_pos = forward ? 0 : count - 1;
+    } else {
+        m_pos = (forward ? m_pos + 1 : m_pos + count - 1) % count;
+    }
+
+    return string(elements[at(m_cycle, m_pos)]);
+}
+
+/*
+ * The matches of prefix from rank first on, at most count of them, and how
+ * many there are in all. Typing a longer prefix only searches the range of
+ * the last one, and ranking only looks at the elements with a frecency
+ * score, so the cost doesn't grow with the number of matches.
+ */
+size_t
+Completion::list(const string& prefix, size_t first, size_t count, vector<string>& rows)
+{
+    rows.clear();
+    if (!m_ready) {
+        return 0;
+    }
+
+    lock_guard<mutex> guard { m_index->lock };
+    const auto& elements = m_index->elements;
+
+    if (!m_list.valid || m_list.generation != m_index->generation || m_list.prefix != prefix) {
+        findRange(m_list, prefix);
+    }
+
+    size_t total { m_list.last - m_list.first };
+    for (size_t i = first; i < total && i < first + count; ++i) {
+        rows.emplace_back(elements[at(m_list, i)]);
+    }
+    return total;
+}
+
+/*
+ * Locate the elements matching prefix: a range of the sorted elements in
+ * prefix mode, searched within the last one if prefix extends its prefix,
+ * the best ranked ones in fuzzy mode. m_index->lock must be held.
+ */
+void
+Completion::findRange(Matches& m, const string& prefix)
+{
+    const auto& elements = m_index->elements;
+    bool narrow { m.valid && m.generation == m_index->generation &&
+                  prefix.compare(0, m.prefix.size(), m.prefix) == 0 };
+    m.prefix = prefix;
+    m.generation = m_index->generation;
+    m.valid = true;
+
+    if (m_matchMode == Match_Fuzzy) {
+        m.fuzzy = m_matcher.match(prefix, elements, m_index->masks, FuzzyTopK);
+        m.first = 0;
+        m.last = m.fuzzy.size();
+        rank(m);
+        return;
+    }
+
+    const auto& p = prefix;
+    auto lo = narrow ? begin(elements) + m.first : begin(elements);
+    auto hi = narrow ? begin(elements) + m.last : end(elements);
+    auto first = lower_bound(lo, hi, p,
+            [] (string_view e, string_view p) { return e.compare(0, p.size(), p) < 0; });
+    auto last = upper_bound(first, hi, p,
+            [] (string_view p, string_view e) { return e.compare(0, p.size(), p) > 0; });
+    m.first = first - begin(elements);
+    m.last = last - begin(elements);
+    rank(m);
+}
+
+/*
+ * Order the matches by frecency: fuzzy matches get a bonus on their score,
+ * prefix matches with a score go first, best first, followed by the rest in
+ * alphabetical order. m_index->lock must be held.
+ */
+void
+Completion::rank(Matches& m)
+{
+    m.ranked.clear();
+    m.rankedByIndex.clear();
+    if (!m_frecency) {
+        return;
+    }
+
+    const auto& elements = m_index->elements;
+    time_t now { time(nullptr) };
+
+    if (m_matchMode == Match_Fuzzy) {
+        for (auto& f : m.fuzzy) {
+            double s { m_frecency->score(elements[f.index], now) };
+            f.score += int(FrecencyBonus * log2(1 + s));
+        }
+        stable_sort(begin(m.fuzzy), end(m.fuzzy),
+                [] (const FuzzyMatcher::Match& a, const FuzzyMatcher::Match& b) { return a.score > b.score; });
+        return;
+    }
+
+    /* only the scored elements within the range */
+    scoreElements();
+    vector<pair<double, size_t>> ranked;
+    for (auto i = lower_bound(begin(m_scored), end(m_scored), m.first); i != end(m_scored) && *i < m.last; ++i) {
+        double s { m_frecency->score(elements[*i], now) };
+        if (s > 0) {
+            ranked.emplace_back(s, *i);
+        }
     }
 
-    m_iter = begin(m_elements);
+    stable_sort(begin(ranked), end(ranked),
+            [] (const pair<double, size_t>& a, const pair<double, size_t>& b) { return a.first > b.first; });
+
+    for (const auto& r : ranked) {
+        m.ranked.push_back(r.second);
+    }
+    m.rankedByIndex = m.ranked;
+    sort(begin(m.rankedByIndex), end(m.rankedByIndex));
+}
 
-    return command;
+/*
+ * Find the elements with a frecency score, once per index generation and
+ * frecency version. m_index->lock must be held.
+ */
+void
+Completion::scoreElements()
+{
+    uint64_t version { m_frecency->version() };
+    if (m_scoredValid && m_scoredGeneration == m_index->generation && m_scoredVersion == version) {
+        return;
+    }
+
+    const auto& elements = m_index->elements;
+    time_t now { time(nullptr) };
+    m_scored.clear();
+    for (size_t i = 0; i < elements.size(); ++i) {
+        if (m_frecency->score(elements[i], now) > 0) {
+            m_scored.push_back(i);
+        }
+    }
+    m_scoredGeneration = m_index->generation;
+    m_scoredVersion = version;
+    m_scoredValid = true;
+}
+
+/*
+ * The index of the element at position pos of the ranked matches: the
+ * ranked ones, then the others in the range, skipping the ranked ones.
+ */
+size_t
+Completion::at(const Matches& m, size_t pos) const
+{
+    if (m_matchMode == Match_Fuzzy) {
+        return m.fuzzy[pos].index;
+    }
+    if (pos < m.ranked.size()) {
+        return m.ranked[pos];
+    }
+
+    size_t i { m.first + (pos - m.ranked.size()) };
+    for (auto r : m.rankedByIndex) {
+        if (r > i) {
+            break;
+        }
+        ++i;
+    }
+    return i;
 }
 
 void
 Completion::reset()
 {
-    m_prefix.clear();
-    m_iter = begin(m_elements);
+    m_cycle.prefix.clear();
+    m_cycle.valid = false;
 }
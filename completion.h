@@ -26,21 +26,106 @@
 #ifndef COMPLETION_H
 #define COMPLETION_H
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "frecency.h"
+#include "fuzzy_matcher.h"
+#include "index_cache.h"
+
+/*
+ * Tab-completion of executables in $PATH. The index is built on a
+ * background thread started by start(), which then keeps it up to date
+ * with changes to the $PATH directories where inotify is available.
+ * next(), prev(), and list() must only be called once wait() has returned
+ * true. If a Frecency is set, frequently and recently launched commands
+ * come first.
+ */
 class Completion {
     public:
+        enum MatchMode {
+            Match_Prefix,
+            Match_Fuzzy
+        };
+
         Completion();
         ~Completion();
+        void setMatchMode(MatchMode mode);
+        void setFrecency(const Frecency * frecency);
+        void start(bool rebuildIndex, bool verbose);
+        void notify(std::function<void()> onReady);
+        bool wait(std::chrono::milliseconds timeout);
         std::string next(std::string command);
+        std::string prev(std::string command);
+        std::size_t list(const std::string& prefix, std::size_t first, std::size_t count,
+                std::vector<std::string>& rows);
         void reset();
-        
+
     private:
-        std::string m_prefix;
-        std::vector<std::string> m_elements;
-        std::vector<std::string>::const_iterator m_iter;
+        struct Index;
+
+        /* the elements matching a prefix: a range of the sorted elements,
+         * ranked by frecency, or the best fuzzy matches */
+        struct Matches {
+            std::string prefix;
+            std::size_t first { 0 };
+            std::size_t last { 0 };
+            unsigned long generation { 0 };
+            bool valid { false };
+
+            /* the prefix matches with a frecency score, best first and in
+             * index order; the others follow them alphabetically */
+            std::vector<std::size_t> ranked;
+            std::vector<std::size_t> rankedByIndex;
+
+            std::vector<FuzzyMatcher::Match> fuzzy;
+        };
+
+        static void run(std::shared_ptr<Index> index, std::vector<std::string> pathElements,
+                std::string cacheDir, bool rebuildIndex, bool verbose);
+        static void watch(std::shared_ptr<Index> index, int ifd, const std::map<int, std::string>& watches,
+                std::vector<IndexCache::Dir>& dirs);
+        std::string cycle(std::string command, bool forward);
+        void findRange(Matches& m, const std::string& prefix);
+        void rank(Matches& m);
+        void scoreElements();
+        std::size_t at(const Matches& m, std::size_t pos) const;
+
+    private:
+        std::shared_ptr<Index> m_index;
+        bool m_ready;
+        MatchMode m_matchMode;
+        const Frecency * m_frecency;
+        FuzzyMatcher m_matcher;
+
+        /* what Tab cycles through, an empty prefix if it doesn't, and
+         * the position in it */
+        Matches m_cycle;
+        std::size_t m_pos;
+
+        /* what the dropdown list shows, kept from one keystroke to the
+         * next so a longer prefix only searches the last range */
+        Matches m_list;
+
+        /* the elements with a frecency score, in index order, for the
+         * index generation and frecency version they were computed for */
+        std::vector<std::size_t> m_scored;
+        unsigned long m_scoredGeneration;
+        std::uint64_t m_scoredVersion;
+        bool m_scoredValid;
+
+        /* How many fuzzy matches Tab cycles through */
+        static constexpr std::size_t FuzzyTopK { 64 };
+
+        /* How much a fuzzy match score gains per doubling of frecency */
+        static constexpr int FrecencyBonus { 8 };
 };
 
 #endif /* !COMPLETION_H */
@@ -0,0 +1,163 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+using namespace std;
+
+#include "control_socket.h"
+#include "util.h"
+
+ControlSocket::ControlSocket()
+    : m_fd { -1 }
+{ }
+
+ControlSocket::~ControlSocket()
+{
+    if (m_fd != -1) {
+        close(m_fd);
+        unlink(m_path.c_str());
+    }
+}
+
+string
+ControlSocket::path()
+{
+    try {
+        return Util::getEnv("XDG_RUNTIME_DIR") + "/thingylaunch.sock";
+    } catch (exception&) {
+        return "/tmp/thingylaunch-" + to_string(getuid()) + ".sock";
+    }
+}
+
+static bool
+makeAddress(const string& path, struct sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+/*
+ * Start listening. A socket left behind by a daemon that is gone is
+ * replaced, one that still has a daemon behind it is not.
+ */
+bool
+ControlSocket::listen()
+{
+    m_path = path();
+    struct sockaddr_un addr;
+    if (!makeAddress(m_path, addr)) {
+        return false;
+    }
+
+    int fd { socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) };
+    if (fd == -1) {
+        return false;
+    }
+
+    /* readable and writable by us only: 0600 */
+    mode_t mask { umask(0177) };
+    int rc { bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) };
+    if (rc == -1 && errno == EADDRINUSE && !send("ping")) {
+        unlink(m_path.c_str());
+        rc = bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    }
+    umask(mask);
+
+    if (rc == -1 || ::listen(fd, 4) == -1) {
+        close(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    return true;
+}
+
+/*
+ * Accept a connection and read its request, without the newline. A client
+ * that doesn't say anything in time gets ignored.
+ */
+string
+ControlSocket::receive()
+{
+    int fd { accept(m_fd, nullptr, nullptr) };
+    if (fd == -1) {
+        return string();
+    }
+
+    string request;
+    struct pollfd pfd { fd, POLLIN, 0 };
+    char buf[64];
+    while (request.find('\n') == string::npos && request.size() < sizeof(buf) &&
+           poll(&pfd, 1, ReceiveTimeout) == 1)
+    {
+        ssize_t n { read(fd, buf, sizeof(buf)) };
+        if (n <= 0) {
+            break;
+        }
+        request.append(buf, n);
+    }
+    close(fd);
+
+    return request.substr(0, request.find('\n'));
+}
+
+/*
+ * Send a request to the daemon, return whether there is one.
+ */
+bool
+ControlSocket::send(const string& request)
+{
+    struct sockaddr_un addr;
+    if (!makeAddress(path(), addr)) {
+        return false;
+    }
+
+    int fd { socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) };
+    if (fd == -1) {
+        return false;
+    }
+
+    string line { request + "\n" };
+    bool ok { connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0 &&
+              ::send(fd, line.data(), line.size(), MSG_NOSIGNAL) == ssize_t(line.size()) };
+    close(fd);
+
+    return ok;
+}
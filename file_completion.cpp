@@ -0,0 +1,357 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pwd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib> // getenv
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+#include "file_completion.h"
+
+/*
+ * State shared with the listing threads, which are detached and may
+ * outlive the FileCompletion object.
+ */
+struct FileCompletion::State {
+    mutex lock;
+    condition_variable cond;
+    function<void()> onReady;
+    list<shared_ptr<const Listing>> cache; /* most recently used first */
+    string requested;
+    shared_ptr<const Listing> current;
+};
+
+static const char ShellSpecial[] { " \t\\'\"`$&;|<>()[]{}*?#!" };
+
+FileCompletion::FileCompletion()
+    : m_state { make_shared<State>() },
+      m_requested { false },
+      m_pos { string::npos }
+{ }
+
+FileCompletion::~FileCompletion()
+{
+    notify(nullptr);
+}
+
+void
+FileCompletion::notify(function<void()> onReady)
+{
+    lock_guard<mutex> guard { m_state->lock };
+    m_state->onReady = move(onReady);
+}
+
+string::size_type
+FileCompletion::wordStart(const string& command, string::size_type pos)
+{
+    string::size_type start { 0 };
+    for (string::size_type i = 0; i < pos && i < command.size(); ++i) {
+        if (command[i] == '\\') {
+            ++i;
+        } else if (command[i] == ' ') {
+            start = i + 1;
+        }
+    }
+    return start;
+}
+
+string
+FileCompletion::escape(const string& s)
+{
+    string out;
+    for (char c : s) {
+        if (strchr(ShellSpecial, c)) {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+string
+FileCompletion::unescape(const string& s)
+{
+    string out;
+    for (string::size_type i = 0; i < s.size(); ++i) {
+        if (s[i] == '\\' && i + 1 < s.size()) {
+            ++i;
+        }
+        out += s[i];
+    }
+    return out;
+}
+
+/* expand a leading ~ or ~user and $VAR / ${VAR} references */
+string
+FileCompletion::expand(const string& dir)
+{
+    string out;
+    string::size_type i { 0 };
+
+    if (!dir.empty() && dir[0] == '~') {
+        auto slash = dir.find('/');
+        string user { dir.substr(1, slash == string::npos ? string::npos : slash - 1) };
+        const char * home { nullptr };
+        if (user.empty()) {
+            home = getenv("HOME");
+        } else if (struct passwd * pw = getpwnam(user.c_str())) {
+            home = pw->pw_dir;
+        }
+        if (home) {
+            out = home;
+            i = slash == string::npos ? dir.size() : slash;
+        }
+    }
+
+    while (i < dir.size()) {
+        if (dir[i] != '$') {
+            out += dir[i++];
+            continue;
+        }
+
+        string name;
+        if (i + 1 < dir.size() && dir[i + 1] == '{') {
+            auto close = dir.find('}', i + 2);
+            if (close == string::npos) {
+                out += dir.substr(i);
+                break;
+            }
+            name = dir.substr(i + 2, close - i - 2);
+            i = close + 1;
+        } else {
+            auto end = i + 1;
+            while (end < dir.size() && (isalnum(static_cast<unsigned char>(dir[end])) || dir[end] == '_')) {
+                ++end;
+            }
+            name = dir.substr(i + 1, end - i - 1);
+            i = end;
+        }
+
+        if (name.empty()) {
+            out += '$';
+        } else if (const char * value = getenv(name.c_str())) {
+            out += value;
+        }
+    }
+
+    return out;
+}
+
+/* list a directory, or reuse the cached listing if it didn't change */
+void
+FileCompletion::listDirectory(shared_ptr<State> state, string dir)
+{
+    struct stat sb;
+    shared_ptr<const Listing> listing;
+
+    if (stat(dir.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode)) {
+        {
+            lock_guard<mutex> guard { state->lock };
+            for (auto i = begin(state->cache); i != end(state->cache); ++i) {
+                const auto& l = **i;
+                if (l.dev == sb.st_dev && l.ino == sb.st_ino &&
+                    l.mtime.tv_sec == sb.st_mtim.tv_sec && l.mtime.tv_nsec == sb.st_mtim.tv_nsec)
+                {
+                    listing = *i;
+                    state->cache.erase(i);
+                    break;
+                }
+            }
+        }
+
+        if (!listing) {
+            auto l = make_shared<Listing>();
+            l->dir = dir;
+            l->dev = sb.st_dev;
+            l->ino = sb.st_ino;
+            l->mtime = sb.st_mtim;
+
+            if (DIR * dirp = opendir(dir.c_str())) {
+                int dfd { dirfd(dirp) };
+                struct dirent * dp;
+                struct stat esb;
+                while ((dp = readdir(dirp))) {
+                    const char * name { dp->d_name };
+                    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                        continue;
+                    }
+                    bool isDir { dp->d_type == DT_DIR };
+                    if (dp->d_type == DT_LNK || dp->d_type == DT_UNKNOWN) {
+                        isDir = fstatat(dfd, name, &esb, 0) == 0 && S_ISDIR(esb.st_mode);
+                    }
+                    l->entries.push_back(Entry { name, isDir });
+                }
+                closedir(dirp);
+            }
+
+            sort(begin(l->entries), end(l->entries),
+                    [] (const Entry& a, const Entry& b) { return a.name < b.name; });
+            listing = l;
+        }
+    }
+
+    lock_guard<mutex> guard { state->lock };
+    if (listing) {
+        state->cache.push_front(listing);
+        if (state->cache.size() > CacheSize) {
+            state->cache.pop_back();
+        }
+    } else {
+        /* not a directory: complete to nothing */
+        auto l = make_shared<Listing>();
+        l->dir = dir;
+        listing = l;
+    }
+
+    if (state->requested == dir) {
+        state->current = listing;
+        state->cond.notify_all();
+        if (state->onReady) {
+            state->onReady();
+        }
+    }
+}
+
+bool
+FileCompletion::wait(const string& word, chrono::milliseconds timeout)
+{
+    /* a cycle is in progress */
+    if (!m_prefix.empty()) {
+        return true;
+    }
+
+    unique_lock<mutex> guard { m_state->lock };
+
+    /* (re)list the directory once per cycle, the cache makes it cheap */
+    if (!m_requested) {
+        string raw { unescape(word) };
+        auto slash = raw.rfind('/');
+        string dir { slash == string::npos ? "." : expand(raw.substr(0, slash + 1)) };
+
+        m_state->requested = dir;
+        m_state->current.reset();
+        thread(listDirectory, m_state, dir).detach();
+        m_requested = true;
+    }
+
+    return m_state->cond.wait_for(guard, timeout, [this] { return m_state->current != nullptr; });
+}
+
+string
+FileCompletion::next(const string& word)
+{
+    return cycle(word, true);
+}
+
+string
+FileCompletion::prev(const string& word)
+{
+    return cycle(word, false);
+}
+
+string
+FileCompletion::cycle(const string& word, bool forward)
+{
+    if (m_prefix.empty()) {
+        shared_ptr<const Listing> listing;
+        {
+            lock_guard<mutex> guard { m_state->lock };
+            listing = m_state->current;
+        }
+        if (!listing) {
+            return word;
+        }
+
+        m_prefix = word;
+        m_pos = string::npos;
+        m_matches.clear();
+
+        /* keep the directory part as typed, match on the rest */
+        string raw { unescape(word) };
+        auto slash = raw.rfind('/');
+        string base { slash == string::npos ? raw : raw.substr(slash + 1) };
+        auto dirEnd = slash == string::npos ? 0 : word.rfind('/') + 1;
+        m_dir = word.substr(0, dirEnd);
+
+        auto first = lower_bound(begin(listing->entries), end(listing->entries), base,
+                [] (const Entry& e, const string& p) { return e.name.compare(0, p.size(), p) < 0; });
+        for (auto i = first; i != end(listing->entries) && i->name.compare(0, base.size(), base) == 0; ++i) {
+            /* hidden files only when explicitly asked for */
+            if (i->name[0] == '.' && (base.empty() || base[0] != '.')) {
+                continue;
+            }
+            m_matches.push_back(escape(i->name) + (i->isDir ? "/" : ""));
+        }
+
+        /* complete up to the longest common prefix of all matches first */
+        if (m_matches.size() > 1) {
+            const auto& a = m_matches.front();
+            const auto& b = m_matches.back();
+            auto lcp = mismatch(begin(a), end(a), begin(b)).first - begin(a);
+            /* don't split an escape sequence */
+            auto backslashes = lcp;
+            while (backslashes > 0 && a[backslashes - 1] == '\\') {
+                --backslashes;
+            }
+            if ((lcp - backslashes) % 2) {
+                --lcp;
+            }
+            string common { m_dir + a.substr(0, lcp) };
+            if (common.size() > word.size()) {
+                return common;
+            }
+        }
+    }
+
+    size_t count { m_matches.size() };
+    if (count == 0) {
+        return word;
+    }
+
+    if (m_pos == string::npos) {
+        m_pos = forward ? 0 : count - 1;
+    } else {
+        m_pos = (forward ? m_pos + 1 : m_pos + count - 1) % count;
+    }
+
+    return m_dir + m_matches[m_pos];
+}
+
+void
+FileCompletion::reset()
+{
+    m_requested = false;
+    m_prefix.clear();
+}
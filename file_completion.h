@@ -0,0 +1,95 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef FILE_COMPLETION_H
+#define FILE_COMPLETION_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Tab-completion of file name arguments. Words may start with ~ or ~user
+ * and contain $VAR or ${VAR} references. Directories are listed on a
+ * background thread, and recent listings are kept in a small LRU cache
+ * validated against the directory's inode and modification time.
+ */
+class FileCompletion {
+    public:
+        FileCompletion();
+        ~FileCompletion();
+        void notify(std::function<void()> onReady);
+        bool wait(const std::string& word, std::chrono::milliseconds timeout);
+        std::string next(const std::string& word);
+        std::string prev(const std::string& word);
+        void reset();
+
+        /* where the (possibly backslash-escaped) word ending at pos starts */
+        static std::string::size_type wordStart(const std::string& command, std::string::size_type pos);
+
+    private:
+        struct Entry {
+            std::string name;
+            bool isDir;
+        };
+
+        struct Listing {
+            std::string dir;
+            dev_t dev;
+            ino_t ino;
+            struct timespec mtime;
+            std::vector<Entry> entries; /* sorted */
+        };
+
+        struct State;
+
+    private:
+        static void listDirectory(std::shared_ptr<State> state, std::string dir);
+        static std::string expand(const std::string& dir);
+        static std::string escape(const std::string& s);
+        static std::string unescape(const std::string& s);
+        std::string cycle(const std::string& word, bool forward);
+
+    private:
+        std::shared_ptr<State> m_state;
+        bool m_requested;
+
+        /* the word being completed, its directory, and the matching names */
+        std::string m_prefix;
+        std::string m_dir;
+        std::vector<std::string> m_matches;
+        std::size_t m_pos;
+
+        /* How many directory listings to keep around */
+        static constexpr std::size_t CacheSize { 8 };
+};
+
+#endif /* !FILE_COMPLETION_H */
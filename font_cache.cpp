@@ -0,0 +1,183 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio> // rename, remove
+#include <cstring>
+#include <fstream>
+#include <vector>
+using namespace std;
+
+#include "font_cache.h"
+#include "util.h"
+
+/*
+ * File layout (native byte order):
+ *   Header
+ *   FontRecord[fontCount], oldest first
+ */
+struct FontCache::Header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t fontCount;
+    uint32_t reserved;
+};
+
+struct FontCache::FontRecord {
+    char     pattern[256]; /* NUL-terminated, XLFD names are at most 255 characters */
+    char     name[256];
+    uint64_t fontPathHash;
+    int16_t  ascent;
+    int16_t  descent;
+    int16_t  widths[256];
+    uint32_t reserved;
+};
+
+static const char FontMagic[4] { 'T', 'L', 'F', 'C' };
+static constexpr uint32_t FontVersion { 1 };
+
+FontCache::FontCache()
+    : m_cacheFile { Util::getCacheDir() + "/fonts" }
+{ }
+
+uint64_t
+FontCache::hash(string_view s, uint64_t h)
+{
+    for (unsigned char c : s) {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    /* keep the elements apart */
+    return (h ^ 0xff) * 1099511628211ULL;
+}
+
+/*
+ * All the records of the cache file, if it is valid.
+ */
+bool
+FontCache::read(vector<FontRecord>& recs) const
+{
+    ifstream inFile { m_cacheFile, ios::binary };
+    Header hdr;
+    if (!inFile.read(reinterpret_cast<char *>(&hdr), sizeof(hdr)) ||
+        memcmp(hdr.magic, FontMagic, sizeof(FontMagic)) != 0 ||
+        hdr.version != FontVersion ||
+        hdr.fontCount > MaxFonts)
+    {
+        return false;
+    }
+
+    recs.resize(hdr.fontCount);
+    if (!inFile.read(reinterpret_cast<char *>(recs.data()), recs.size() * sizeof(FontRecord))) {
+        recs.clear();
+        return false;
+    }
+
+    /* no unterminated strings */
+    for (auto& r : recs) {
+        r.pattern[sizeof(r.pattern) - 1] = '\0';
+        r.name[sizeof(r.name) - 1] = '\0';
+    }
+    return true;
+}
+
+bool
+FontCache::lookup(const string& pattern, Font& font, uint64_t& fontPathHash) const
+{
+    vector<FontRecord> recs;
+    if (!read(recs)) {
+        return false;
+    }
+
+    for (const auto& r : recs) {
+        if (pattern != r.pattern) {
+            continue;
+        }
+
+        fontPathHash = r.fontPathHash;
+        font.name = r.name;
+        font.ascent = r.ascent;
+        font.descent = r.descent;
+        memcpy(font.widths, r.widths, sizeof(font.widths));
+        return true;
+    }
+
+    return false;
+}
+
+bool
+FontCache::save(const string& pattern, uint64_t fontPathHash, const Font& font) const
+{
+    if (pattern.size() >= sizeof(FontRecord::pattern) || font.name.size() >= sizeof(FontRecord::name)) {
+        return false;
+    }
+
+    FontRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.pattern, pattern.data(), pattern.size());
+    memcpy(rec.name, font.name.data(), font.name.size());
+    rec.fontPathHash = fontPathHash;
+    rec.ascent = font.ascent;
+    rec.descent = font.descent;
+    memcpy(rec.widths, font.widths, sizeof(rec.widths));
+
+    /* keep the other patterns, up to MaxFonts in all */
+    vector<FontRecord> recs;
+    read(recs);
+    recs.erase(remove_if(recs.begin(), recs.end(),
+                [&pattern](const FontRecord& r) { return pattern == r.pattern; }),
+            recs.end());
+    if (recs.size() >= MaxFonts) {
+        recs.erase(recs.begin(), recs.end() - (MaxFonts - 1));
+    }
+    recs.push_back(rec);
+
+    Header hdr;
+    memcpy(hdr.magic, FontMagic, sizeof(FontMagic));
+    hdr.version = FontVersion;
+    hdr.fontCount = recs.size();
+    hdr.reserved = 0;
+
+    /* write to a temporary file and atomically replace the cache */
+    string tmpFile { m_cacheFile + ".tmp." + to_string(getpid()) };
+    {
+        ofstream outFile { tmpFile, ios::binary | ios::trunc };
+        outFile.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        outFile.write(reinterpret_cast<const char *>(recs.data()), recs.size() * sizeof(FontRecord));
+        if (!outFile.good()) {
+            remove(tmpFile.c_str());
+            return false;
+        }
+    }
+
+    if (rename(tmpFile.c_str(), m_cacheFile.c_str()) == -1) {
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
+}
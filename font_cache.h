@@ -0,0 +1,69 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef FONT_CACHE_H
+#define FONT_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * On-disk cache of the fonts the XLFD patterns resolved to, with their
+ * metrics. Entries are keyed on the pattern and a hash of the server's
+ * font path, so a changed font path resolves the pattern again.
+ */
+class FontCache {
+    public:
+        struct Font {
+            std::string name;
+            int16_t     ascent;
+            int16_t     descent;
+            int16_t     widths[256]; /* of the characters 0 to 255 */
+        };
+
+        FontCache();
+        /* the font and the hash of the font path it was resolved with */
+        bool lookup(const std::string& pattern, Font& font, uint64_t& fontPathHash) const;
+        bool save(const std::string& pattern, uint64_t fontPathHash, const Font& font) const;
+
+        /* FNV-1a, to be fed the font path elements in turn */
+        static uint64_t hash(std::string_view s, uint64_t h = 14695981039346656037ULL);
+
+    private:
+        struct Header;
+        struct FontRecord;
+        bool read(std::vector<FontRecord>& recs) const;
+
+    private:
+        std::string m_cacheFile;
+
+        /* patterns kept, the least recently saved go first */
+        static constexpr uint32_t MaxFonts { 8 };
+};
+
+#endif /* !FONT_CACHE_H */
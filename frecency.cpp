@@ -0,0 +1,319 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio> // rename, remove
+#include <cstring>
+#include <string>
+using namespace std;
+
+#include "frecency.h"
+#include "util.h"
+
+/*
+ * File layout (native byte order):
+ *   Header
+ *   Record[SlotCount]
+ *
+ * A name hashes to a window of MaxProbe consecutive slots, which is
+ * probed linearly. Empty slots have a zero hash. When the window is full,
+ * the record with the lowest score is replaced.
+ */
+struct Frecency::Header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t reserved;
+};
+
+struct Frecency::Record {
+    uint64_t hash;
+    uint32_t count;
+    uint32_t reserved;
+    int64_t  last;
+    char     name[48]; /* for the curious, possibly truncated */
+};
+
+static const char FrecencyMagic[4] { 'T', 'L', 'F', 'R' };
+static constexpr uint32_t FrecencyVersion { 1 };
+
+Frecency::Frecency()
+    : m_frecencyFile { Util::getEnv("HOME") + "/.thingylaunch.frecency" }
+{ }
+
+Frecency::~Frecency()
+{
+    // nothing to do...
+}
+
+const Frecency::Record *
+Frecency::records() const
+{
+    return reinterpret_cast<const Record *>(m_map.data() + sizeof(Header));
+}
+
+bool
+Frecency::load()
+{
+    if (!m_map.open(m_frecencyFile)) {
+        return false;
+    }
+
+    const Header * hdr { reinterpret_cast<const Header *>(m_map.data()) };
+    if (m_map.size() != sizeof(Header) + SlotCount * sizeof(Record) ||
+        memcmp(hdr->magic, FrecencyMagic, sizeof(FrecencyMagic)) != 0 ||
+        hdr->version != FrecencyVersion ||
+        hdr->slotCount != SlotCount)
+    {
+        m_map.close();
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t
+Frecency::hash(string_view name)
+{
+    /* FNV-1a, never zero */
+    uint64_t h { 14695981039346656037ull };
+    for (unsigned char c : name) {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
+/*
+ * The executable a command line runs, which is what completion offers.
+ */
+string_view
+Frecency::commandName(string_view command)
+{
+    auto first { command.find_first_not_of(" \t") };
+    if (first == string_view::npos) {
+        return string_view();
+    }
+    command.remove_prefix(first);
+    return command.substr(0, command.find_first_of(" \t"));
+}
+
+double
+Frecency::score(const Record& rec, time_t now)
+{
+    double age { double(max<int64_t>(now - rec.last, 0)) };
+    return rec.count * exp2(-age / HalfLife);
+}
+
+double
+Frecency::score(string_view name, time_t now) const
+{
+    if (!m_map.data()) {
+        return 0;
+    }
+
+    uint64_t h { hash(name) };
+    const Record * rec { records() + h % (SlotCount - MaxProbe + 1) };
+    for (uint32_t i = 0; i < MaxProbe && rec[i].hash; ++i) {
+        if (rec[i].hash == h) {
+            return score(rec[i], now);
+        }
+    }
+    return 0;
+}
+
+/*
+ * A value that changes whenever a launch is recorded, by any instance:
+ * a checksum of the records. The mapping is shared, so it shows them as
+ * soon as they are written.
+ */
+uint64_t
+Frecency::version() const
+{
+    if (!m_map.data()) {
+        return 0;
+    }
+
+    uint64_t v { 0 };
+    const Record * rec { records() };
+    for (uint32_t i = 0; i < SlotCount; ++i) {
+        v = (v ^ rec[i].hash ^ rec[i].count ^ uint64_t(rec[i].last)) * 1099511628211ull;
+    }
+    return v;
+}
+
+/*
+ * Open the file and lock it. The file might have been replaced by the
+ * time the lock is granted, in which case it is opened again.
+ */
+int
+Frecency::openLocked()
+{
+    for (;;) {
+        int fd { open(m_frecencyFile.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600) };
+        if (fd == -1) {
+            return -1;
+        }
+
+        while (flock(fd, LOCK_EX) == -1) {
+            if (errno != EINTR) {
+                close(fd);
+                return -1;
+            }
+        }
+
+        struct stat fsb, psb;
+        if (fstat(fd, &fsb) == 0 && stat(m_frecencyFile.c_str(), &psb) == 0 &&
+            fsb.st_dev == psb.st_dev && fsb.st_ino == psb.st_ino)
+        {
+            return fd;
+        }
+
+        close(fd);
+    }
+}
+
+/*
+ * Replace the file with an empty table, returned locked. The table is
+ * written to a new file renamed over the old one, which other instances
+ * may have mapped: truncating it would pull the pages from under them.
+ * Must be called with the lock held.
+ */
+int
+Frecency::recreate()
+{
+    string tmpFile { m_frecencyFile + ".tmp." + to_string(getpid()) };
+    int fd { open(tmpFile.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+    if (fd == -1) {
+        return -1;
+    }
+
+    Header hdr;
+    memcpy(hdr.magic, FrecencyMagic, sizeof(FrecencyMagic));
+    hdr.version = FrecencyVersion;
+    hdr.slotCount = SlotCount;
+    hdr.reserved = 0;
+
+    /* locked before it shows up under the real name */
+    if (flock(fd, LOCK_EX) == -1 ||
+        ftruncate(fd, sizeof(Header) + SlotCount * sizeof(Record)) == -1 ||
+        pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        rename(tmpFile.c_str(), m_frecencyFile.c_str()) == -1)
+    {
+        close(fd);
+        remove(tmpFile.c_str());
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Record a launch of command. Only the record of its name is rewritten,
+ * under a lock so concurrent instances don't clobber each other's windows.
+ */
+void
+Frecency::add(string_view command)
+{
+    string_view name { commandName(command) };
+    if (name.empty()) {
+        return;
+    }
+
+    int fd { openLocked() };
+    if (fd == -1) {
+        return;
+    }
+
+    /* create the table, or start over if it's not one we understand */
+    constexpr off_t fileSize { sizeof(Header) + SlotCount * sizeof(Record) };
+    struct stat sb;
+    Header hdr;
+    if (fstat(fd, &sb) == -1 || sb.st_size != fileSize ||
+        pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        memcmp(hdr.magic, FrecencyMagic, sizeof(FrecencyMagic)) != 0 ||
+        hdr.version != FrecencyVersion ||
+        hdr.slotCount != SlotCount)
+    {
+        int newFd { recreate() };
+        close(fd);
+        if (newFd == -1) {
+            return;
+        }
+        fd = newFd;
+    }
+
+    uint64_t h { hash(name) };
+    uint32_t first { uint32_t(h % (SlotCount - MaxProbe + 1)) };
+    off_t offset { off_t(sizeof(Header) + first * sizeof(Record)) };
+    Record window[MaxProbe];
+    if (pread(fd, window, sizeof(window), offset) != sizeof(window)) {
+        close(fd);
+        return;
+    }
+
+    /* our record, else an empty slot, else the least valuable one */
+    time_t now { time(nullptr) };
+    uint32_t slot { MaxProbe };
+    for (uint32_t i = 0; i < MaxProbe; ++i) {
+        if (window[i].hash == h || window[i].hash == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == MaxProbe) {
+        slot = min_element(begin(window), end(window), [now] (const Record& a, const Record& b) {
+                return score(a, now) < score(b, now);
+            }) - begin(window);
+    }
+
+    Record& rec { window[slot] };
+    if (rec.hash != h) {
+        memset(&rec, 0, sizeof(rec));
+        rec.hash = h;
+        memcpy(rec.name, name.data(), min(name.size(), sizeof(rec.name) - 1));
+    }
+    ++rec.count;
+    rec.last = now;
+
+    ssize_t written { pwrite(fd, &rec, sizeof(rec), offset + slot * sizeof(Record)) };
+    close(fd); /* releases the lock */
+    if (written != sizeof(rec)) {
+        return;
+    }
+
+    /* the mapping sees writes to the file, but there might be none yet */
+    if (!m_map.data()) {
+        load();
+    }
+}
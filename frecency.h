@@ -0,0 +1,74 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+#include "mapped_file.h"
+
+/*
+ * Launch counts and last-use times of commands, kept in a fixed-size, open
+ * addressing hash table in ~/.thingylaunch.frecency. The file is mapped as
+ * is, so loading costs nothing, and recording a launch rewrites a single
+ * record in place.
+ */
+class Frecency {
+    public:
+        Frecency();
+        ~Frecency();
+        bool load();
+        void add(std::string_view command);
+        double score(std::string_view name, std::time_t now) const;
+        std::uint64_t version() const;
+
+    private:
+        struct Header;
+        struct Record;
+        const Record * records() const;
+        static std::uint64_t hash(std::string_view name);
+        static std::string_view commandName(std::string_view command);
+        static double score(const Record& rec, std::time_t now);
+        int openLocked();
+        int recreate();
+
+    private:
+        std::string m_frecencyFile;
+        MappedFile  m_map;
+
+        static constexpr std::uint32_t SlotCount { 1024 };
+        static constexpr std::uint32_t MaxProbe { 16 };
+
+        /* A launch counts half as much after this many seconds */
+        static constexpr double HalfLife { 7 * 24 * 3600 };
+};
+
+#endif /* !FRECENCY_H */
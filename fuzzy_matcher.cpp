@@ -0,0 +1,259 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <climits>
+#include <queue>
+using namespace std;
+
+#include "fuzzy_matcher.h"
+
+/* scoring parameters, loosely following fzf */
+static constexpr int ScoreMatch { 16 };
+static constexpr int GapStart { -3 };
+static constexpr int GapExtension { -1 };
+static constexpr int BonusBoundary { 8 };
+static constexpr int BonusCamel { 7 };
+static constexpr int BonusConsecutive { 4 };
+static constexpr int BonusFirstCharMultiplier { 2 };
+
+static constexpr int NoMatch { INT_MIN / 2 };
+
+/* ASCII-only helpers, cheaper than the locale-aware <cctype> ones */
+static inline bool
+isLower(unsigned char c)
+{
+    return c >= 'a' && c <= 'z';
+}
+
+static inline bool
+isUpper(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z';
+}
+
+static inline bool
+isDigit(unsigned char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool
+isAlnum(unsigned char c)
+{
+    return isLower(c) || isUpper(c) || isDigit(c);
+}
+
+static inline unsigned char
+fold(char c)
+{
+    return isUpper(c) ? c - 'A' + 'a' : c;
+}
+
+static inline int
+charBit(unsigned char c)
+{
+    if (isLower(c)) {
+        return c - 'a';
+    }
+    if (isDigit(c)) {
+        return 26 + c - '0';
+    }
+    return 36 + c % 28;
+}
+
+uint64_t
+FuzzyMatcher::charMask(string_view s)
+{
+    uint64_t mask { 0 };
+    for (char c : s) {
+        mask |= uint64_t(1) << charBit(fold(c));
+    }
+    return mask;
+}
+
+/* the bonus for matching at position i of s */
+static int
+bonus(string_view s, size_t i)
+{
+    if (i == 0) {
+        return BonusBoundary;
+    }
+
+    unsigned char prev = s[i - 1];
+    unsigned char cur = s[i];
+    if (!isAlnum(prev)) {
+        return isAlnum(cur) ? BonusBoundary : 0;
+    }
+    if (isLower(prev) && isUpper(cur)) {
+        return BonusCamel;
+    }
+    if (!isDigit(prev) && isDigit(cur)) {
+        return BonusCamel;
+    }
+    return 0;
+}
+
+/*
+ * Collect the indices of the candidates whose character set is a superset
+ * of the query's into m_survivors.
+ */
+void
+FuzzyMatcher::prefilter(uint64_t queryMask, const vector<uint64_t>& masks)
+{
+    m_survivors.clear();
+    size_t i { 0 };
+    size_t n { masks.size() };
+
+#ifdef __SSE2__
+    /* two candidates per iteration: (mask & query) == query */
+    const __m128i q { _mm_set1_epi64x(queryMask) };
+    for (; i + 2 <= n; i += 2) {
+        __m128i m { _mm_loadu_si128(reinterpret_cast<const __m128i *>(&masks[i])) };
+        int hit { _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(m, q), q)) };
+        if ((hit & 0x00ff) == 0x00ff) {
+            m_survivors.push_back(i);
+        }
+        if ((hit & 0xff00) == 0xff00) {
+            m_survivors.push_back(i + 1);
+        }
+    }
+#endif
+
+    for (; i < n; ++i) {
+        if ((masks[i] & queryMask) == queryMask) {
+            m_survivors.push_back(i);
+        }
+    }
+}
+
+int
+FuzzyMatcher::score(string_view query, string_view candidate)
+{
+    size_t m { query.size() };
+    size_t n { candidate.size() };
+    if (m == 0 || m > n) {
+        return m == 0 ? 0 : -1;
+    }
+
+    /* cheap subsequence check before running the DP */
+    size_t qi { 0 };
+    for (size_t j = 0; j < n && qi < m; ++j) {
+        if (fold(candidate[j]) == fold(query[qi])) {
+            ++qi;
+        }
+    }
+    if (qi < m) {
+        return -1;
+    }
+
+    /*
+     * row[j] is the best score of matching query[0..i] with query[i]
+     * matched at candidate[j].
+     */
+    int best { NoMatch };
+    m_prevRow.resize(n);
+    for (size_t j = 0; j < n; ++j) {
+        m_prevRow[j] = NoMatch;
+        if (fold(candidate[j]) == fold(query[0])) {
+            m_prevRow[j] = ScoreMatch + bonus(candidate, j) * BonusFirstCharMultiplier + GapExtension * int(j);
+            best = max(best, m_prevRow[j]);
+        }
+    }
+    if (m == 1) {
+        return max(best, 0);
+    }
+    m_row.resize(n);
+
+    for (size_t i = 1; i < m; ++i) {
+        int gapBest { NoMatch };
+        for (size_t j = 0; j < n; ++j) {
+            /* best predecessor at least two positions to the left */
+            if (j >= 2) {
+                gapBest = max(gapBest + GapExtension, m_prevRow[j - 2] + GapStart);
+            }
+
+            m_row[j] = NoMatch;
+            if (j >= i && fold(candidate[j]) == fold(query[i])) {
+                int consecutive { m_prevRow[j - 1] + BonusConsecutive };
+                int best { max(consecutive, gapBest) };
+                if (best > NoMatch / 2) {
+                    m_row[j] = best + ScoreMatch + bonus(candidate, j);
+                }
+            }
+        }
+        swap(m_prevRow, m_row);
+    }
+
+    best = *max_element(begin(m_prevRow), end(m_prevRow));
+    return best > NoMatch / 2 ? max(best, 0) : -1;
+}
+
+vector<FuzzyMatcher::Match>
+FuzzyMatcher::match(string_view query, const StringTable& candidates,
+        const vector<uint64_t>& masks, size_t topK)
+{
+    prefilter(charMask(query), masks);
+
+    /* ties are broken by shorter names first, then alphabetically */
+    auto better = [&candidates] (const Match& a, const Match& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        if (candidates[a.index].size() != candidates[b.index].size()) {
+            return candidates[a.index].size() < candidates[b.index].size();
+        }
+        return a.index < b.index;
+    };
+
+    /* keep the best topK in a heap whose top is the worst of them */
+    priority_queue<Match, vector<Match>, decltype(better)> heap { better };
+    for (auto i : m_survivors) {
+        int s { score(query, candidates[i]) };
+        if (s < 0) {
+            continue;
+        }
+        Match mt { i, s };
+        if (heap.size() < topK) {
+            heap.push(mt);
+        } else if (better(mt, heap.top())) {
+            heap.pop();
+            heap.push(mt);
+        }
+    }
+
+    vector<Match> result;
+    result.reserve(heap.size());
+    while (!heap.empty()) {
+        result.push_back(heap.top());
+        heap.pop();
+    }
+    reverse(begin(result), end(result));
+    return result;
+}
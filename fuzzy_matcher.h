@@ -0,0 +1,69 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef FUZZY_MATCHER_H
+#define FUZZY_MATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "string_table.h"
+
+/*
+ * Subsequence matching with fzf-style scoring: matches at word boundaries,
+ * camelCase humps, and consecutive runs score higher, gaps cost points.
+ * Matching is case-insensitive. Candidates are first filtered by comparing
+ * 64-bit character-set masks, so the scoring only runs on plausible ones.
+ */
+class FuzzyMatcher {
+    public:
+        struct Match {
+            std::size_t index;
+            int score;
+        };
+
+        static uint64_t charMask(std::string_view s);
+
+        /* the best topK candidates, best first */
+        std::vector<Match> match(std::string_view query,
+                const StringTable& candidates,
+                const std::vector<uint64_t>& masks,
+                std::size_t topK);
+
+        /* the score of a candidate, or -1 if the query isn't a subsequence of it */
+        int score(std::string_view query, std::string_view candidate);
+
+    private:
+        void prefilter(uint64_t queryMask, const std::vector<uint64_t>& masks);
+
+    private:
+        std::vector<std::size_t> m_survivors;
+        std::vector<int> m_prevRow;
+        std::vector<int> m_row;
+};
+
+#endif /* !FUZZY_MATCHER_H */
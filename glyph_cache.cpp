@@ -0,0 +1,366 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <fontconfig/fontconfig.h>
+
+#include <cmath>
+#include <cstdio> // rename, remove, snprintf
+#include <cstring>
+#include <fstream>
+using namespace std;
+
+#include "font_cache.h"
+#include "glyph_cache.h"
+#include "trace.h"
+#include "util.h"
+
+/*
+ * File layout (native byte order):
+ *   Header
+ *   pattern, font file name
+ *   GlyphRecord[glyphCount]
+ *   alpha bitmaps
+ */
+struct GlyphCache::Header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t patternLen;
+    uint32_t fontFileLen;
+    int64_t  fontMtime;
+    int64_t  fontSize;
+    int32_t  fontIndex;
+    int32_t  pixelSize;
+    int32_t  ascent;
+    int32_t  descent;
+    uint32_t glyphCount;
+    uint32_t reserved;
+};
+
+struct GlyphCache::GlyphRecord {
+    uint32_t codepoint;
+    uint16_t width;
+    uint16_t height;
+    int16_t  left;
+    int16_t  top;
+    int16_t  advance;
+    int16_t  reserved;
+    uint32_t dataOff;
+};
+
+static const char GlyphMagic[4] { 'T', 'L', 'G', 'C' };
+static constexpr uint32_t GlyphVersion { 1 };
+
+GlyphCache::GlyphCache()
+    : m_fontIndex { 0 },
+      m_pixelSize { 0 },
+      m_ascent { 0 },
+      m_descent { 0 },
+      m_library { nullptr },
+      m_face { nullptr },
+      m_dirty { false }
+{ }
+
+GlyphCache::~GlyphCache()
+{
+    if (m_face) {
+        FT_Done_Face(m_face);
+    }
+    if (m_library) {
+        FT_Done_FreeType(m_library);
+    }
+}
+
+/*
+ * Get the glyphs of a font pattern from the cache, or find the font and
+ * rasterize the printable ASCII characters for the next time.
+ */
+bool
+GlyphCache::open(const string& pattern)
+{
+    TRACE_PHASE("open glyph cache");
+
+    m_pattern = pattern;
+
+    /* one file per pattern */
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(FontCache::hash(pattern)));
+    m_cacheFile = Util::getCacheDir() + "/glyphs-" + hash;
+
+    if (load()) {
+        return true;
+    }
+
+    /* cold start: ask fontconfig */
+    if (!FcInit()) {
+        return false;
+    }
+    FcPattern * pat { FcNameParse(reinterpret_cast<const FcChar8 *>(pattern.c_str())) };
+    if (!pat) {
+        return false;
+    }
+    FcConfigSubstitute(nullptr, pat, FcMatchPattern);
+    FcDefaultSubstitute(pat);
+    FcResult result;
+    FcPattern * match { FcFontMatch(nullptr, pat, &result) };
+    FcPatternDestroy(pat);
+    if (!match) {
+        return false;
+    }
+
+    FcChar8 * file;
+    double pixelSize;
+    int index;
+    bool ok { FcPatternGetString(match, FC_FILE, 0, &file) == FcResultMatch };
+    if (ok) {
+        m_fontFile = reinterpret_cast<const char *>(file);
+    }
+    if (FcPatternGetDouble(match, FC_PIXEL_SIZE, 0, &pixelSize) != FcResultMatch) {
+        pixelSize = 16;
+    }
+    if (FcPatternGetInteger(match, FC_INDEX, 0, &index) != FcResultMatch) {
+        index = 0;
+    }
+    FcPatternDestroy(match);
+    if (!ok) {
+        return false;
+    }
+    m_fontIndex = index;
+    m_pixelSize = lround(pixelSize);
+
+    if (!openFace()) {
+        return false;
+    }
+
+    for (uint32_t c = 0x20; c < 0x7f; ++c) {
+        glyph(c);
+    }
+    save();
+
+    return true;
+}
+
+bool
+GlyphCache::load()
+{
+    if (!m_map.open(m_cacheFile) || m_map.size() < sizeof(Header)) {
+        return false;
+    }
+
+    Header hdr;
+    memcpy(&hdr, m_map.data(), sizeof(hdr));
+    size_t namesEnd { sizeof(Header) + size_t(hdr.patternLen) + hdr.fontFileLen };
+    if (memcmp(hdr.magic, GlyphMagic, sizeof(GlyphMagic)) != 0 ||
+        hdr.version != GlyphVersion ||
+        namesEnd > m_map.size() ||
+        hdr.glyphCount > (m_map.size() - namesEnd) / sizeof(GlyphRecord) ||
+        string_view(m_map.data() + sizeof(Header), hdr.patternLen) != m_pattern)
+    {
+        m_map.close();
+        return false;
+    }
+
+    /* the font file must not have changed */
+    string fontFile(m_map.data() + sizeof(Header) + hdr.patternLen, hdr.fontFileLen);
+    struct stat sb;
+    if (stat(fontFile.c_str(), &sb) == -1 || sb.st_mtime != hdr.fontMtime || sb.st_size != hdr.fontSize) {
+        m_map.close();
+        return false;
+    }
+
+    const char * records { m_map.data() + namesEnd };
+    for (uint32_t i = 0; i < hdr.glyphCount; ++i) {
+        GlyphRecord r;
+        memcpy(&r, records + i * sizeof(GlyphRecord), sizeof(r));
+        Glyph g { r.width, r.height, r.left, r.top, r.advance, nullptr };
+        if (uint64_t(r.dataOff) + g.stride() * g.height > m_map.size()) {
+            m_glyphs.clear();
+            m_map.close();
+            return false;
+        }
+        g.alpha = reinterpret_cast<const uint8_t *>(m_map.data()) + r.dataOff;
+        m_glyphs.emplace(r.codepoint, g);
+    }
+
+    m_fontFile = move(fontFile);
+    m_fontIndex = hdr.fontIndex;
+    m_pixelSize = hdr.pixelSize;
+    m_ascent = hdr.ascent;
+    m_descent = hdr.descent;
+    return true;
+}
+
+bool
+GlyphCache::openFace()
+{
+    if (m_face) {
+        return true;
+    }
+
+    TRACE_PHASE("open font face");
+    if (!m_library && FT_Init_FreeType(&m_library) != 0) {
+        m_library = nullptr;
+        return false;
+    }
+    if (FT_New_Face(m_library, m_fontFile.c_str(), m_fontIndex, &m_face) != 0) {
+        m_face = nullptr;
+        return false;
+    }
+    if (FT_Set_Pixel_Sizes(m_face, 0, m_pixelSize) != 0) {
+        FT_Done_Face(m_face);
+        m_face = nullptr;
+        return false;
+    }
+
+    m_ascent = (m_face->size->metrics.ascender + 63) >> 6;
+    m_descent = (-m_face->size->metrics.descender + 63) >> 6;
+    return true;
+}
+
+bool
+GlyphCache::rasterize(uint32_t codepoint, Glyph& glyph)
+{
+    if (!openFace() || FT_Load_Char(m_face, codepoint, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT) != 0) {
+        return false;
+    }
+
+    const FT_Bitmap& bm { m_face->glyph->bitmap };
+    if (bm.pixel_mode != FT_PIXEL_MODE_GRAY && bm.rows != 0) {
+        return false;
+    }
+
+    glyph.width = bm.width;
+    glyph.height = bm.rows;
+    glyph.left = m_face->glyph->bitmap_left;
+    glyph.top = m_face->glyph->bitmap_top;
+    glyph.advance = (m_face->glyph->advance.x + 32) >> 6;
+
+    /* rows padded to 4 bytes, as the X server wants them */
+    size_t stride { glyph.stride() };
+    unique_ptr<uint8_t[]> alpha { new uint8_t[stride * glyph.height + 1]() };
+    for (unsigned y = 0; y < bm.rows; ++y) {
+        memcpy(alpha.get() + y * stride, bm.buffer + y * bm.pitch, bm.width);
+    }
+    glyph.alpha = alpha.get();
+    m_bitmaps.push_back(move(alpha));
+    return true;
+}
+
+/*
+ * The glyph of a character, rasterized on first use if the cache doesn't
+ * have it. Characters the font lacks get its missing glyph.
+ */
+const GlyphCache::Glyph *
+GlyphCache::glyph(uint32_t codepoint)
+{
+    auto i = m_glyphs.find(codepoint);
+    if (i != m_glyphs.end()) {
+        return &i->second;
+    }
+
+    TRACE_PHASE("rasterize");
+    Glyph g;
+    if (!rasterize(codepoint, g)) {
+        return nullptr;
+    }
+    m_dirty = true;
+    return &m_glyphs.emplace(codepoint, g).first->second;
+}
+
+/*
+ * Write the cache file again if glyphs were rasterized since it was read.
+ */
+bool
+GlyphCache::save()
+{
+    if (!m_dirty) {
+        return true;
+    }
+
+    struct stat sb;
+    if (stat(m_fontFile.c_str(), &sb) == -1) {
+        return false;
+    }
+
+    Header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, GlyphMagic, sizeof(GlyphMagic));
+    hdr.version = GlyphVersion;
+    hdr.patternLen = m_pattern.size();
+    hdr.fontFileLen = m_fontFile.size();
+    hdr.fontMtime = sb.st_mtime;
+    hdr.fontSize = sb.st_size;
+    hdr.fontIndex = m_fontIndex;
+    hdr.pixelSize = m_pixelSize;
+    hdr.ascent = m_ascent;
+    hdr.descent = m_descent;
+    hdr.glyphCount = m_glyphs.size();
+
+    vector<GlyphRecord> recs;
+    string blob;
+    uint32_t dataOff = sizeof(Header) + m_pattern.size() + m_fontFile.size() + m_glyphs.size() * sizeof(GlyphRecord);
+    for (const auto& [codepoint, g] : m_glyphs) {
+        GlyphRecord r;
+        memset(&r, 0, sizeof(r));
+        r.codepoint = codepoint;
+        r.width = g.width;
+        r.height = g.height;
+        r.left = g.left;
+        r.top = g.top;
+        r.advance = g.advance;
+        r.dataOff = dataOff + blob.size();
+        blob.append(reinterpret_cast<const char *>(g.alpha), g.stride() * g.height);
+        recs.push_back(r);
+    }
+
+    /* write to a temporary file and atomically replace the cache */
+    string tmpFile { m_cacheFile + ".tmp." + to_string(getpid()) };
+    {
+        ofstream outFile { tmpFile, ios::binary | ios::trunc };
+        outFile.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        outFile.write(m_pattern.data(), m_pattern.size());
+        outFile.write(m_fontFile.data(), m_fontFile.size());
+        outFile.write(reinterpret_cast<const char *>(recs.data()), recs.size() * sizeof(GlyphRecord));
+        outFile.write(blob.data(), blob.size());
+        if (!outFile.good()) {
+            remove(tmpFile.c_str());
+            return false;
+        }
+    }
+
+    if (rename(tmpFile.c_str(), m_cacheFile.c_str()) == -1) {
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    m_dirty = false;
+    return true;
+}
@@ -0,0 +1,98 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.h"
+
+struct FT_LibraryRec_;
+struct FT_FaceRec_;
+
+/*
+ * Anti-aliased glyphs rasterized with FreeType from the font fontconfig
+ * matches a pattern like "DejaVu Sans Mono-11" to. The glyphs are kept in
+ * $XDG_CACHE_HOME/thingylaunch, keyed on the pattern and validated against
+ * the font file, so a warm start neither asks fontconfig nor rasterizes.
+ */
+class GlyphCache {
+    public:
+        struct Glyph {
+            uint16_t width;
+            uint16_t height;
+            int16_t  left;    /* from the origin to the left of the bitmap */
+            int16_t  top;     /* from the baseline up to the top of the bitmap */
+            int16_t  advance;
+            const uint8_t * alpha; /* height rows of stride() bytes */
+
+            std::size_t stride() const { return (width + 3u) & ~3u; }
+        };
+
+        GlyphCache();
+        ~GlyphCache();
+        bool open(const std::string& pattern);
+        int ascent() const { return m_ascent; }
+        int descent() const { return m_descent; }
+        const Glyph * glyph(uint32_t codepoint);
+        bool save();
+
+    private:
+        GlyphCache(const GlyphCache&) = delete;
+        GlyphCache& operator=(const GlyphCache&) = delete;
+
+        struct Header;
+        struct GlyphRecord;
+        bool load();
+        bool openFace();
+        bool rasterize(uint32_t codepoint, Glyph& glyph);
+
+    private:
+        std::string m_pattern;
+        std::string m_cacheFile;
+        std::string m_fontFile;
+        int         m_fontIndex;
+        int         m_pixelSize;
+        int         m_ascent;
+        int         m_descent;
+
+        FT_LibraryRec_ * m_library;
+        FT_FaceRec_    * m_face;
+
+        /* glyphs point into the mapping of the cache file, or into
+         * m_bitmaps for the ones rasterized since */
+        MappedFile m_map;
+        std::unordered_map<uint32_t, Glyph> m_glyphs;
+        std::vector<std::unique_ptr<uint8_t[]>> m_bitmaps;
+        bool m_dirty;
+};
+
+#endif /* !GLYPH_CACHE_H */
@@ -23,74 +23,519 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <numeric>
 #include <iostream>
-#include <iterator>
+#include <unordered_set>
 using namespace std;
 
 #include "history.h"
+#include "trace.h"
 #include "util.h"
 
 History::History()
-    : m_historyFile { Util::getEnv("HOME") + "/.thingylaunch.history" }
+    : m_historyFile { Util::getEnv("HOME") + "/.thingylaunch.history" },
+      m_base { nullptr },
+      m_fileEntries { 0 },
+      m_maxSize { DefaultMaxSize },
+      m_loaded { false },
+      m_pos { -1 },
+      m_searchPos { 0 }
+{ }
+
+History::~History()
 {
-    ifstream inFile { m_historyFile };
-    string line;
+    // nothing to do...
+}
+
+/*
+ * Map the history file and index the newest m_maxSize non-empty lines,
+ * scanning backwards from the end so that older entries are never touched.
+ * Lines beyond that are only counted, up to the compaction threshold.
+ */
+void
+History::load()
+{
+    if (m_loaded) {
+        return;
+    }
+    m_loaded = true;
+
+    TRACE_PHASE("load history");
+    if (!m_file.open(m_historyFile)) {
+        return;
+    }
 
-    while (inFile.good()) {
-        getline(inFile, line);
-        if (!line.empty()) {
-            m_elements.push_back(move(line));
+    /* offsets are 32 bits; nobody has 4GB of history worth indexing, so
+     * only look at the tail and drop the partial line at its start */
+    const char * base { m_file.data() };
+    size_t size { m_file.size() };
+    if (size > UINT32_MAX) {
+        base += size - UINT32_MAX;
+        size = UINT32_MAX;
+    }
+
+    /* work on locals, so the scan loop doesn't go through this */
+    vector<uint32_t> lines;
+    size_t maxSize { m_maxSize };
+    size_t countLimit { maxSize + maxSize / 2 };
+    size_t count { 0 };
+    size_t end { size }; /* one past the line being scanned */
+    auto addLine = [&](size_t start) {
+        if (start != end) {
+            if (count < maxSize) {
+                lines.push_back(start);
+            }
+            ++count;
+        }
+    };
+
+    lines.reserve(min(maxSize, size / 2 + 1));
+    size_t i { size };
+
+#ifdef __SSE2__
+    /* sixteen bytes per iteration, newlines picked from the top bit down */
+    const __m128i nl { _mm_set1_epi8('\n') };
+    while (i >= 16 && count < countLimit) {
+        i -= 16;
+        __m128i v { _mm_loadu_si128(reinterpret_cast<const __m128i *>(base + i)) };
+        unsigned hits { unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl))) };
+        while (hits) {
+            unsigned bit { 31u - __builtin_clz(hits) };
+            addLine(i + bit + 1);
+            end = i + bit;
+            hits &= ~(1u << bit);
         }
     }
+#endif
 
-    m_iter = begin(m_elements) - 1;
+    while (i > 0 && count < countLimit) {
+        auto p { static_cast<const char *>(memrchr(base, '\n', i)) };
+        if (!p) {
+            break;
+        }
+        i = p - base;
+        addLine(i + 1);
+        end = i;
+    }
+
+    if (count < countLimit && base == m_file.data()) {
+        addLine(0);
+    }
+
+    m_base = base;
+    m_lines = move(lines);
+    m_fileEntries = count;
 }
 
-History::~History()
+string_view
+History::line(size_t id) const
 {
-    // nothing to do...
+    const char * start { m_base + m_lines[id] };
+    const char * fileEnd { m_file.data() + m_file.size() };
+    auto end { static_cast<const char *>(memchr(start, '\n', fileEnd - start)) };
+    return string_view(start, (end ? end : fileEnd) - start);
 }
 
-string
-History::next()
+/*
+ * Start navigating from the typed command line, visiting only the entries
+ * starting with prefix, newest first, or all of them if it's empty.
+ */
+void
+History::setPrefix(string_view prefix)
 {
-    if (m_elements.empty()) {
-        return string();
+    m_prefix = prefix;
+    m_pos = -1;
+    m_matches.clear();
+
+    if (m_prefix.empty()) {
+        return;
+    }
+
+    load();
+    if (m_sorted.size() != m_lines.size()) {
+        buildSorted();
     }
 
-    if (m_iter >= end(m_elements) - 1) {
-        m_iter = begin(m_elements) - 1;
+    const auto& p = m_prefix;
+    auto first = lower_bound(begin(m_sorted), end(m_sorted), p,
+            [this] (uint32_t id, string_view p) { return line(id).compare(0, p.size(), p) < 0; });
+    auto last = upper_bound(first, end(m_sorted), p,
+            [this] (string_view p, uint32_t id) { return line(id).compare(0, p.size(), p) > 0; });
+
+    /* equal entries are adjacent, the newest first: keep that one only */
+    string_view prev;
+    for (auto i = first; i != last; ++i) {
+        string_view l { line(*i) };
+        if (i == first || l != prev) {
+            m_matches.push_back(*i);
+        }
+        prev = l;
     }
+    sort(begin(m_matches), end(m_matches));
+}
 
-    ++m_iter;
+/*
+ * Order the line ids lexicographically, newest first among equal entries.
+ */
+void
+History::buildSorted()
+{
+    m_sorted.resize(m_lines.size());
+    iota(begin(m_sorted), end(m_sorted), 0);
+    sort(begin(m_sorted), end(m_sorted), [this] (uint32_t a, uint32_t b) {
+            int cmp { line(a).compare(line(b)) };
+            return cmp < 0 || (cmp == 0 && a < b);
+        });
+}
 
-    return *m_iter;
+/*
+ * The number of entries navigated through, not counting the typed
+ * command line at position -1.
+ */
+size_t
+History::navigationSize() const
+{
+    return m_prefix.empty() ? m_lines.size() : m_matches.size();
+}
+
+optional<string_view>
+History::navigationEntry() const
+{
+    if (m_pos == -1) {
+        return nullopt;
+    }
+    return line(m_prefix.empty() ? m_pos : m_matches[m_pos]);
 }
 
-string
+optional<string_view>
 History::prev()
 {
-    if (m_elements.empty()) {
-        return string();
+    load();
+
+    ptrdiff_t count { ptrdiff_t(navigationSize()) };
+    m_pos = m_pos + 1 >= count ? -1 : m_pos + 1;
+    return navigationEntry();
+}
+
+optional<string_view>
+History::next()
+{
+    load();
+
+    ptrdiff_t count { ptrdiff_t(navigationSize()) };
+    m_pos = m_pos == -1 ? count - 1 : m_pos - 1;
+    return navigationEntry();
+}
+
+/*
+ * Find the newest entry containing query, starting from the current match,
+ * or from the one before it if older is set.
+ */
+optional<string_view>
+History::search(string_view query, bool older)
+{
+    load();
+
+    size_t from { m_searchPos + (older ? 1 : 0) };
+    if (query.empty() || from >= m_lines.size()) {
+        return nullopt;
     }
 
-    if (m_iter <= begin(m_elements)) {
-        m_iter = end(m_elements);
+    size_t id { from };
+    if (query.size() < 3) {
+        /* too short for the index; such matches are rarely far off anyway */
+        while (id < m_lines.size() && line(id).find(query) == string_view::npos) {
+            ++id;
+        }
+    } else {
+        if (m_trigramOffsets.empty()) {
+            buildTrigrams();
+        }
+        id = findTrigrams(query, from);
     }
 
-    --m_iter;
+    if (id >= m_lines.size()) {
+        return nullopt;
+    }
 
-    return *m_iter;
+    m_searchPos = id;
+    return line(id);
+}
+
+void
+History::resetSearch()
+{
+    m_searchPos = 0;
+}
+
+uint32_t
+History::trigram(const char * p)
+{
+    uint32_t t { uint32_t(uint8_t(p[0])) << 16 | uint32_t(uint8_t(p[1])) << 8 | uint8_t(p[2]) };
+    return (t * 0x9e3779b1u) >> (32 - TrigramBits);
+}
+
+/*
+ * Build the trigram index over the indexed lines: for each (hashed)
+ * trigram, the ids of the lines containing it, in ascending order. Hash
+ * collisions only cost some false positives, which are verified anyway.
+ */
+void
+History::buildTrigrams()
+{
+    /* the last line each trigram was seen in, plus one, to count a line
+     * only once per trigram without sorting its trigrams */
+    vector<uint32_t> seen(1u << TrigramBits);
+    auto forEach = [&](uint32_t id, auto&& f) {
+        string_view l { line(id) };
+        for (size_t i = 0; i + 3 <= l.size(); ++i) {
+            uint32_t t { trigram(l.data() + i) };
+            if (seen[t] != id + 1) {
+                seen[t] = id + 1;
+                f(t);
+            }
+        }
+    };
+
+    /* count, then fill: postings end up sorted by line id */
+    vector<uint32_t> offsets((1u << TrigramBits) + 1);
+    for (uint32_t id = 0; id < m_lines.size(); ++id) {
+        forEach(id, [&](uint32_t t) { ++offsets[t + 1]; });
+    }
+    partial_sum(begin(offsets), end(offsets), begin(offsets));
+
+    fill(begin(seen), end(seen), 0);
+    vector<uint32_t> postings(offsets.back());
+    vector<uint32_t> next(begin(offsets), end(offsets) - 1);
+    for (uint32_t id = 0; id < m_lines.size(); ++id) {
+        forEach(id, [&](uint32_t t) { postings[next[t]++] = id; });
+    }
+
+    m_trigramOffsets = move(offsets);
+    m_postings = move(postings);
+}
+
+/*
+ * Intersect the posting lists of the trigrams of query, leapfrogging from
+ * the shortest, and return the first line at or after from that really
+ * contains query, or m_lines.size().
+ */
+size_t
+History::findTrigrams(string_view query, size_t from) const
+{
+    struct List {
+        const uint32_t * first;
+        const uint32_t * last;
+    };
+
+    vector<uint32_t> trigrams;
+    for (size_t i = 0; i + 3 <= query.size(); ++i) {
+        trigrams.push_back(trigram(query.data() + i));
+    }
+    sort(begin(trigrams), end(trigrams));
+    trigrams.erase(unique(begin(trigrams), end(trigrams)), end(trigrams));
+
+    vector<List> lists;
+    for (auto t : trigrams) {
+        lists.push_back({ m_postings.data() + m_trigramOffsets[t], m_postings.data() + m_trigramOffsets[t + 1] });
+    }
+    sort(begin(lists), end(lists),
+            [] (const List& a, const List& b) { return a.last - a.first < b.last - b.first; });
+
+    size_t id { from };
+    for (;;) {
+        bool agreed { true };
+        for (auto& l : lists) {
+            l.first = lower_bound(l.first, l.last, id);
+            if (l.first == l.last) {
+                return m_lines.size();
+            }
+            if (*l.first != id) {
+                id = *l.first;
+                agreed = false;
+                break;
+            }
+        }
+        if (agreed) {
+            if (line(id).find(query) != string_view::npos) {
+                return id;
+            }
+            ++id;
+        }
+    }
+}
+
+void
+History::setMaxSize(size_t maxSize)
+{
+    m_maxSize = maxSize;
+}
+
+/*
+ * Open the history file for appending and lock it. The file might be
+ * replaced by a compaction while we wait for the lock, in which case the
+ * new one is opened instead.
+ */
+int
+History::openLocked()
+{
+    for (;;) {
+        int fd { open(m_historyFile.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600) };
+        if (fd == -1) {
+            return -1;
+        }
+
+        while (flock(fd, LOCK_EX) == -1) {
+            if (errno != EINTR) {
+                close(fd);
+                return -1;
+            }
+        }
+
+        struct stat fsb, psb;
+        if (fstat(fd, &fsb) == 0 && stat(m_historyFile.c_str(), &psb) == 0 &&
+            fsb.st_dev == psb.st_dev && fsb.st_ino == psb.st_ino)
+        {
+            return fd;
+        }
+
+        close(fd);
+    }
 }
 
 void
 History::save(string entry)
 {
-    ofstream outFile { m_historyFile };
-    copy (begin(m_elements), end(m_elements),
-            ostream_iterator<string>(outFile, "\n"));
-    if (!m_elements.size() || *(end(m_elements) - 1) != entry) {
-        outFile << entry;
+    if (entry.empty()) {
+        return;
     }
+
+    load();
+    if (!m_lines.empty() && line(0) == entry) {
+        return;
+    }
+
+    int fd { openLocked() };
+    if (fd == -1) {
+        return;
+    }
+
+    /* older versions didn't terminate the last entry */
+    string line;
+    struct stat sb;
+    char last;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0 &&
+        pread(fd, &last, 1, sb.st_size - 1) == 1 && last != '\n')
+    {
+        line += '\n';
+    }
+    line += entry;
+    line += '\n';
+
+    /* a single write, so readers never see a torn entry */
+    const char * p { line.data() };
+    size_t left { line.size() };
+    while (left) {
+        ssize_t n { write(fd, p, left) };
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+
+    /* compact once the file has grown well past the limit */
+    if (m_fileEntries + 1 > m_maxSize + m_maxSize / 2) {
+        compact();
+    }
+
+    close(fd); /* releases the lock */
+
+    /* a daemon sees the new entry the next time around */
+    unload();
+}
+
+void
+History::unload()
+{
+    m_file.close();
+    m_base = nullptr;
+    m_lines.clear();
+    m_fileEntries = 0;
+    m_loaded = false;
+    m_prefix.clear();
+    m_matches.clear();
+    m_sorted.clear();
+    m_pos = -1;
+    m_searchPos = 0;
+    m_trigramOffsets.clear();
+    m_postings.clear();
+}
+
+/*
+ * Rewrite the history file with only the newest occurrence of each entry,
+ * and at most m_maxSize of them. Must be called with the lock held.
+ */
+bool
+History::compact()
+{
+    vector<string> lines;
+    {
+        ifstream inFile { m_historyFile };
+        string line;
+        while (getline(inFile, line)) {
+            if (!line.empty()) {
+                lines.push_back(move(line));
+            }
+        }
+    }
+
+    /* keep the newest occurrences, walking backwards */
+    vector<const string *> kept;
+    unordered_set<string_view> seen;
+    for (auto i = lines.rbegin(); i != lines.rend() && kept.size() < m_maxSize; ++i) {
+        if (seen.insert(*i).second) {
+            kept.push_back(&*i);
+        }
+    }
+
+    string tmpFile { m_historyFile + ".tmp." + to_string(getpid()) };
+    int tmp { open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+    if (tmp == -1) {
+        return false;
+    }
+
+    string data;
+    for (auto i = kept.rbegin(); i != kept.rend(); ++i) {
+        data += **i;
+        data += '\n';
+    }
+
+    bool ok { write(tmp, data.data(), data.size()) == ssize_t(data.size()) && fsync(tmp) == 0 };
+    ok = close(tmp) == 0 && ok;
+    if (!ok || rename(tmpFile.c_str(), m_historyFile.c_str()) == -1) {
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
 }
@@ -26,21 +26,80 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
+#include <cstddef>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "mapped_file.h"
+
+/*
+ * Command history, kept in ~/.thingylaunch.history. The file is mapped on
+ * first use and only the newest entries are indexed, as offsets into the
+ * mapping. Entries are appended under an advisory lock, so concurrent
+ * instances don't lose each other's entries. Once the file has grown well
+ * past the maximum size, it is deduplicated and trimmed, and then
+ * atomically replaced. Up/Down navigation can be restricted to entries
+ * starting with a prefix, found in a sorted view of the entries, and
+ * search() finds substrings through a trigram index. Both are built on
+ * first use.
+ */
 class History {
     public:
         History();
         ~History();
-        std::string next();
-        std::string prev();
+        void setPrefix(std::string_view prefix);
+        std::optional<std::string_view> next();
+        std::optional<std::string_view> prev();
+        std::optional<std::string_view> search(std::string_view query, bool older);
+        void resetSearch();
+        void setMaxSize(std::size_t maxSize);
         void save(std::string entry);
 
+        static constexpr std::size_t DefaultMaxSize { 10000 };
+
+    private:
+        void load();
+        void unload();
+        std::string_view line(std::size_t id) const;
+        void buildSorted();
+        std::size_t navigationSize() const;
+        std::optional<std::string_view> navigationEntry() const;
+        static std::uint32_t trigram(const char * p);
+        void buildTrigrams();
+        std::size_t findTrigrams(std::string_view query, std::size_t from) const;
+        int openLocked();
+        bool compact();
+
     private:
         std::string m_historyFile;
-        std::vector<std::string> m_elements;
-        std::vector<std::string>::const_iterator m_iter;
+        MappedFile m_file;
+        const char * m_base;
+        std::vector<std::uint32_t> m_lines; /* line offsets, newest first */
+        std::size_t m_fileEntries;
+        std::size_t m_maxSize;
+        bool m_loaded;
+
+        /* Up/Down navigation: the prefix entries must start with, the ids
+         * of those entries, newest first, and the position among them, -1
+         * being the typed command line. m_sorted holds all the line ids in
+         * lexicographic order, newest first among equal entries. */
+        std::string m_prefix;
+        std::vector<std::uint32_t> m_matches;
+        std::vector<std::uint32_t> m_sorted;
+        std::ptrdiff_t m_pos;
+
+        /* the line id of the current search match, and the trigram index:
+         * the ids of the lines with the hashed trigram t are found in
+         * m_postings, in [m_trigramOffsets[t], m_trigramOffsets[t + 1]) */
+        std::size_t m_searchPos;
+        std::vector<std::uint32_t> m_trigramOffsets;
+        std::vector<std::uint32_t> m_postings;
+
+        /* The number of bits trigrams are hashed to */
+        static constexpr unsigned TrigramBits { 18 };
 };
 
 #endif /* !HISTORY_H */
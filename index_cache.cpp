@@ -0,0 +1,312 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio> // rename, remove
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+using namespace std;
+
+#include "index_cache.h"
+#include "util.h"
+
+/*
+ * File layout (native byte order):
+ *   Header
+ *   DirRecord[dirCount]
+ *   the directory paths, and for the merged index and each directory, a
+ *   StringTable: its (offset, length) pairs, 8-byte aligned, and the
+ *   characters they point into; the fuzzy masks of the merged index,
+ *   8-byte aligned
+ */
+struct IndexCache::Table {
+    uint32_t refsOff;
+    uint32_t count;
+    uint32_t charsOff;
+    uint32_t charsLen;
+};
+
+struct IndexCache::Header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t dirCount;
+    uint32_t hasMerged; /* the merged index is that of the directories, in order */
+    Table    merged;
+    uint32_t masksOff;
+    uint32_t reserved;
+};
+
+struct IndexCache::DirRecord {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t  mtimeSec;
+    int64_t  mtimeNsec;
+    uint32_t pathOff;
+    uint32_t pathLen;
+    Table    names;
+};
+
+static const char IndexMagic[4] { 'T', 'L', 'I', 'X' };
+static constexpr uint32_t IndexVersion { 2 };
+
+IndexCache::IndexCache(const string& cacheDir)
+    : m_indexFile { cacheDir + "/index" },
+      m_map { make_shared<MappedFile>() },
+      m_dirCount { 0 }
+{ }
+
+IndexCache::~IndexCache()
+{
+    // nothing to do...
+}
+
+const IndexCache::Header *
+IndexCache::header() const
+{
+    return reinterpret_cast<const Header *>(m_map->data());
+}
+
+const IndexCache::DirRecord *
+IndexCache::records() const
+{
+    return reinterpret_cast<const DirRecord *>(m_map->data() + sizeof(Header));
+}
+
+/*
+ * Whether a table lies within the mapping, and its pairs within its
+ * characters. Checking the pairs is a pass over them, but no copy.
+ */
+bool
+IndexCache::validTable(const Table& t) const
+{
+    if (t.refsOff % alignof(StringTable::Ref) != 0 ||
+        uint64_t(t.refsOff) + uint64_t(t.count) * sizeof(StringTable::Ref) > m_map->size() ||
+        uint64_t(t.charsOff) + t.charsLen > m_map->size())
+    {
+        return false;
+    }
+
+    const StringTable::Ref * refs { reinterpret_cast<const StringTable::Ref *>(m_map->data() + t.refsOff) };
+    uint64_t end { 0 };
+    for (uint32_t i = 0; i < t.count; ++i) {
+        end = max(end, uint64_t(refs[i].offset) + refs[i].length);
+    }
+    return end <= t.charsLen;
+}
+
+void
+IndexCache::borrow(const Table& t, StringTable& names) const
+{
+    names.borrow(m_map, reinterpret_cast<const StringTable::Ref *>(m_map->data() + t.refsOff), t.count,
+            m_map->data() + t.charsOff, t.charsLen);
+}
+
+bool
+IndexCache::load()
+{
+    m_dirCount = 0;
+
+    if (!m_map->open(m_indexFile) || m_map->size() < sizeof(Header)) {
+        return false;
+    }
+
+    const Header * hdr { header() };
+    if (memcmp(hdr->magic, IndexMagic, sizeof(IndexMagic)) != 0 ||
+        hdr->version != IndexVersion ||
+        hdr->dirCount > (m_map->size() - sizeof(Header)) / sizeof(DirRecord))
+    {
+        m_map->close();
+        return false;
+    }
+
+    /* make sure nothing points outside of the mapping */
+    bool ok { !hdr->hasMerged ||
+              (validTable(hdr->merged) && hdr->masksOff % alignof(uint64_t) == 0 &&
+               uint64_t(hdr->masksOff) + uint64_t(hdr->merged.count) * sizeof(uint64_t) <= m_map->size()) };
+    const DirRecord * rec { records() };
+    for (uint32_t i = 0; i < hdr->dirCount && ok; ++i) {
+        ok = uint64_t(rec[i].pathOff) + rec[i].pathLen <= m_map->size() && validTable(rec[i].names);
+    }
+    if (!ok) {
+        m_map->close();
+        return false;
+    }
+
+    m_dirCount = hdr->dirCount;
+    return true;
+}
+
+bool
+IndexCache::sameDir(const DirRecord& r, const struct stat& sb)
+{
+    return r.dev == uint64_t(sb.st_dev) && r.ino == uint64_t(sb.st_ino) &&
+           r.mtimeSec == int64_t(sb.st_mtim.tv_sec) && r.mtimeNsec == int64_t(sb.st_mtim.tv_nsec);
+}
+
+bool
+IndexCache::lookup(const string& path, const struct stat& sb, StringTable& names) const
+{
+    const DirRecord * rec { records() };
+    for (uint32_t i = 0; i < m_dirCount; ++i) {
+        const auto& r = rec[i];
+        if (r.pathLen != path.size() || memcmp(m_map->data() + r.pathOff, path.data(), r.pathLen) != 0) {
+            continue;
+        }
+
+        if (!sameDir(r, sb)) {
+            return false;
+        }
+
+        borrow(r.names, names);
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * The merged index of dirs, if it was saved for the same directories in
+ * the same order, none of which changed since.
+ */
+bool
+IndexCache::merged(const vector<Dir>& dirs, StringTable& elements, vector<uint64_t>& masks) const
+{
+    if (!m_map->data() || !header()->hasMerged || m_dirCount != dirs.size()) {
+        return false;
+    }
+
+    const DirRecord * rec { records() };
+    for (uint32_t i = 0; i < m_dirCount; ++i) {
+        const auto& r = rec[i];
+        const auto& d = dirs[i];
+        if (r.pathLen != d.path.size() || memcmp(m_map->data() + r.pathOff, d.path.data(), r.pathLen) != 0 ||
+            !sameDir(r, d.sb))
+        {
+            return false;
+        }
+    }
+
+    const Header * hdr { header() };
+    borrow(hdr->merged, elements);
+    const uint64_t * m { reinterpret_cast<const uint64_t *>(m_map->data() + hdr->masksOff) };
+    masks.assign(m, m + hdr->merged.count);
+    return true;
+}
+
+bool
+IndexCache::isFresh(const struct stat& sb)
+{
+    /* a directory modified within the last couple of seconds might still
+     * change without its mtime moving on coarse-grained file systems */
+    return time(nullptr) - sb.st_mtim.tv_sec < 2;
+}
+
+/* append a table to the blob, at blobOff in the file */
+static void
+appendTable(string& blob, uint32_t blobOff, const StringTable& names, uint32_t& refsOff, uint32_t& charsOff)
+{
+    blob.resize((blobOff + blob.size() + 7) / 8 * 8 - blobOff);
+    refsOff = blobOff + blob.size();
+    blob.append(reinterpret_cast<const char *>(names.refs()), names.size() * sizeof(StringTable::Ref));
+    charsOff = blobOff + blob.size();
+    blob.append(names.chars(), names.dataSize());
+}
+
+bool
+IndexCache::save(const vector<Dir>& dirs, const StringTable& elements, const vector<uint64_t>& masks) const
+{
+    vector<DirRecord> recs;
+    for (const auto& d : dirs) {
+        if (!isFresh(d.sb)) {
+            recs.emplace_back();
+        }
+    }
+
+    Header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, IndexMagic, sizeof(IndexMagic));
+    hdr.version = IndexVersion;
+    hdr.dirCount = recs.size();
+
+    /* blob offsets are relative to the start of the file */
+    uint32_t blobOff = sizeof(Header) + recs.size() * sizeof(DirRecord);
+    string blob;
+
+    /* the merged index only goes with all of the directories */
+    if (recs.size() == dirs.size()) {
+        hdr.hasMerged = 1;
+        hdr.merged.count = elements.size();
+        hdr.merged.charsLen = elements.dataSize();
+        appendTable(blob, blobOff, elements, hdr.merged.refsOff, hdr.merged.charsOff);
+        blob.resize((blobOff + blob.size() + 7) / 8 * 8 - blobOff);
+        hdr.masksOff = blobOff + blob.size();
+        blob.append(reinterpret_cast<const char *>(masks.data()), masks.size() * sizeof(uint64_t));
+    }
+
+    auto r = recs.begin();
+    for (const auto& d : dirs) {
+        if (isFresh(d.sb)) {
+            continue;
+        }
+
+        memset(&*r, 0, sizeof(*r));
+        r->dev = d.sb.st_dev;
+        r->ino = d.sb.st_ino;
+        r->mtimeSec = d.sb.st_mtim.tv_sec;
+        r->mtimeNsec = d.sb.st_mtim.tv_nsec;
+        r->pathOff = blobOff + blob.size();
+        r->pathLen = d.path.size();
+        blob += d.path;
+        r->names.count = d.names.size();
+        r->names.charsLen = d.names.dataSize();
+        appendTable(blob, blobOff, d.names, r->names.refsOff, r->names.charsOff);
+        ++r;
+    }
+
+    /* write to a temporary file and atomically replace the index */
+    string tmpFile { m_indexFile + ".tmp." + to_string(getpid()) };
+    {
+        ofstream outFile { tmpFile, ios::binary | ios::trunc };
+        outFile.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        outFile.write(reinterpret_cast<const char *>(recs.data()), recs.size() * sizeof(DirRecord));
+        outFile.write(blob.data(), blob.size());
+        if (!outFile.good()) {
+            remove(tmpFile.c_str());
+            return false;
+        }
+    }
+
+    if (rename(tmpFile.c_str(), m_indexFile.c_str()) == -1) {
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef INDEX_CACHE_H
+#define INDEX_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "string_table.h"
+
+/*
+ * On-disk cache of the executables found in each $PATH directory. Entries
+ * are keyed on the directory path and validated against its device, inode,
+ * and modification time, so only directories that changed need a rescan.
+ * The names are read in place from the mapped file. When no directory
+ * changed, the merged index and its fuzzy masks come from the file too.
+ */
+class IndexCache {
+    public:
+        struct Dir {
+            std::string path;
+            struct stat sb;
+            StringTable names; /* sorted */
+        };
+
+        explicit IndexCache(const std::string& cacheDir);
+        ~IndexCache();
+        bool load();
+        bool lookup(const std::string& path, const struct stat& sb, StringTable& names) const;
+        bool merged(const std::vector<Dir>& dirs, StringTable& elements, std::vector<uint64_t>& masks) const;
+        bool save(const std::vector<Dir>& dirs, const StringTable& elements,
+                const std::vector<uint64_t>& masks) const;
+
+    private:
+        struct Table;
+        struct Header;
+        struct DirRecord;
+        const Header * header() const;
+        const DirRecord * records() const;
+        bool validTable(const Table& t) const;
+        void borrow(const Table& t, StringTable& names) const;
+        static bool sameDir(const DirRecord& r, const struct stat& sb);
+        static bool isFresh(const struct stat& sb);
+
+    private:
+        std::string m_indexFile;
+        std::shared_ptr<MappedFile> m_map;
+        uint32_t    m_dirCount;
+};
+
+#endif /* !INDEX_CACHE_H */
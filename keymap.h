@@ -0,0 +1,82 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * What key presses mean: the keysym and the character of each keycode
+ * under each combination of the modifiers that select a keysym, worked
+ * out once from the core keyboard and modifier mappings. The rules are
+ * those of the core protocol for the two groups, Shift, Lock, and
+ * NumLock, plus the third and fourth levels of the core mapping XKB
+ * exposes, selected by the modifier holding ISO_Level3_Shift (AltGr).
+ * Translating a key press is then a matter of indexing a table.
+ */
+class Keymap {
+    public:
+        struct Key {
+            uint32_t keysym;
+            uint32_t ch;     /* the Unicode character, 0 if none */
+        };
+
+        Keymap();
+        void build(uint8_t minKeycode, unsigned keycodeCount, unsigned keysymsPerKeycode, const uint32_t * keysyms,
+                unsigned keycodesPerModifier, const uint8_t * modifierKeycodes);
+        const Key& translate(uint8_t keycode, uint16_t state) const
+        {
+            return m_keys[keycode * Combos + m_combos[state & 0xff]];
+        }
+        std::vector<uint8_t> keycodes(uint32_t keysym) const;
+        uint16_t numLockMask() const { return m_numLockMask; }
+        static uint32_t toUnicode(uint32_t keysym);
+
+    private:
+        static Key resolve(const uint32_t * row, unsigned count, unsigned combo, bool capsLock);
+        static uint32_t upper(uint32_t keysym);
+        static uint32_t lower(uint32_t keysym);
+        static bool isKeypad(uint32_t keysym);
+
+    private:
+        /* the modifiers that matter, as bits of a combination */
+        enum {
+            Combo_Shift   = 1,
+            Combo_Lock    = 2,
+            Combo_NumLock = 4,
+            Combo_Group2  = 8,
+            Combo_Level3  = 16,
+            Combos        = 32
+        };
+
+        uint8_t          m_combos[256]; /* by the modifier bits of the state */
+        std::vector<Key> m_keys;        /* Combos entries per keycode */
+        uint16_t         m_numLockMask;
+};
+
+#endif /* !KEYMAP_H */
@@ -0,0 +1,231 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+using namespace std;
+
+#include "string_table.h"
+
+StringTable::StringTable()
+    : m_chars { nullptr },
+      m_refsData { nullptr },
+      m_count { 0 },
+      m_bytes { 0 },
+      m_dead { 0 }
+{ }
+
+StringTable::StringTable(const StringTable& other)
+    : StringTable()
+{
+    *this = other;
+}
+
+StringTable::StringTable(StringTable&& other)
+    : StringTable()
+{
+    *this = move(other);
+}
+
+StringTable&
+StringTable::operator=(const StringTable& other)
+{
+    if (this == &other) {
+        return *this;
+    }
+    m_blob = other.m_blob;
+    m_refs = other.m_refs;
+    m_owner = other.m_owner;
+    m_dead = other.m_dead;
+    if (m_owner) {
+        m_chars = other.m_chars;
+        m_refsData = other.m_refsData;
+        m_count = other.m_count;
+        m_bytes = other.m_bytes;
+    } else {
+        sync();
+    }
+    return *this;
+}
+
+StringTable&
+StringTable::operator=(StringTable&& other)
+{
+    if (this == &other) {
+        return *this;
+    }
+    /* the vectors' storage moves along, so the pointers stay good */
+    m_blob = move(other.m_blob);
+    m_refs = move(other.m_refs);
+    m_owner = move(other.m_owner);
+    m_chars = other.m_chars;
+    m_refsData = other.m_refsData;
+    m_count = other.m_count;
+    m_bytes = other.m_bytes;
+    m_dead = other.m_dead;
+    other.clear();
+    return *this;
+}
+
+/*
+ * Copy a borrowed table before changing it. What it was borrowed from is
+ * returned, for the caller to keep alive while it might still read from it.
+ */
+shared_ptr<const void>
+StringTable::own()
+{
+    if (m_owner) {
+        m_refs.assign(m_refsData, m_refsData + m_count);
+        compact(m_chars);
+    }
+    return move(m_owner);
+}
+
+/*
+ * Rebuild m_blob from the characters m_refs point to in chars, in the
+ * order of m_refs, and point the references at the new copy.
+ */
+void
+StringTable::compact(const char * chars)
+{
+    vector<char> blob;
+    blob.reserve(m_bytes - m_dead);
+    for (auto& r : m_refs) {
+        uint32_t offset { uint32_t(blob.size()) };
+        blob.insert(blob.end(), chars + r.offset, chars + r.offset + r.length);
+        r.offset = offset;
+    }
+    m_blob = move(blob);
+    m_dead = 0;
+}
+
+/* read from the vectors again after changing them */
+void
+StringTable::sync()
+{
+    m_chars = m_blob.data();
+    m_refsData = m_refs.data();
+    m_count = m_refs.size();
+    m_bytes = m_blob.size();
+}
+
+void
+StringTable::borrow(shared_ptr<const void> owner, const Ref * refs, size_t count,
+        const char * chars, size_t bytes)
+{
+    m_blob = vector<char>();
+    m_refs = vector<Ref>();
+    m_owner = move(owner);
+    m_dead = 0;
+    m_chars = chars;
+    m_refsData = refs;
+    m_count = count;
+    m_bytes = bytes;
+}
+
+void
+StringTable::reserve(size_t count, size_t bytes)
+{
+    auto borrowed = own();
+    m_refs.reserve(count);
+    m_blob.reserve(bytes);
+    sync();
+}
+
+void
+StringTable::push_back(string_view s)
+{
+    auto borrowed = own();
+    m_refs.push_back(Ref { uint32_t(m_blob.size()), uint32_t(s.size()) });
+    m_blob.insert(m_blob.end(), s.begin(), s.end());
+    sync();
+}
+
+void
+StringTable::insert(size_t pos, string_view s)
+{
+    auto borrowed = own();
+    /* the characters always go at the end of the blob, only the order of
+     * the references matters */
+    m_refs.insert(m_refs.begin() + pos, Ref { uint32_t(m_blob.size()), uint32_t(s.size()) });
+    m_blob.insert(m_blob.end(), s.begin(), s.end());
+    sync();
+}
+
+void
+StringTable::erase(size_t pos)
+{
+    auto borrowed = own();
+    /* the characters are left behind until they outweigh the live ones */
+    m_dead += m_refs[pos].length;
+    m_refs.erase(m_refs.begin() + pos);
+    if (m_dead > m_blob.size() - m_dead) {
+        compact(m_blob.data());
+    }
+    sync();
+}
+
+void
+StringTable::append(const StringTable& other)
+{
+    auto borrowed = own();
+    uint32_t base { uint32_t(m_blob.size()) };
+    m_dead += other.m_dead;
+    m_blob.insert(m_blob.end(), other.m_chars, other.m_chars + other.m_bytes);
+    m_refs.reserve(m_refs.size() + other.m_count);
+    for (size_t i = 0; i < other.m_count; ++i) {
+        m_refs.push_back(Ref { base + other.m_refsData[i].offset, other.m_refsData[i].length });
+    }
+    sync();
+}
+
+void
+StringTable::clear()
+{
+    m_owner.reset();
+    m_blob.clear();
+    m_refs.clear();
+    m_dead = 0;
+    sync();
+}
+
+void
+StringTable::sort()
+{
+    auto borrowed = own();
+    const char * blob { m_blob.data() };
+    std::sort(m_refs.begin(), m_refs.end(), [blob] (const Ref& a, const Ref& b) {
+        return string_view(blob + a.offset, a.length) < string_view(blob + b.offset, b.length);
+    });
+    sync();
+}
+
+size_t
+StringTable::capacityBytes() const
+{
+    if (m_owner) {
+        return m_bytes + m_count * sizeof(Ref);
+    }
+    return m_blob.capacity() + m_refs.capacity() * sizeof(Ref);
+}
@@ -0,0 +1,145 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef STRING_TABLE_H
+#define STRING_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/*
+ * A list of strings stored back to back in a single character blob, with
+ * a compact array of (offset, length) pairs on the side. Elements are
+ * handed out as string_views, which remain valid until the next change.
+ * Erasing leaves the characters in the blob, until they outnumber the live
+ * ones and the blob is compacted.
+ *
+ * The blob and the pairs can also be borrowed from elsewhere, such as a
+ * mapped file, without copying them. They are copied on the first change.
+ */
+class StringTable {
+    public:
+        struct Ref {
+            uint32_t offset;
+            uint32_t length;
+        };
+
+
+        class const_iterator {
+            public:
+                typedef std::random_access_iterator_tag iterator_category;
+                typedef std::string_view value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef const std::string_view * pointer;
+                typedef std::string_view reference;
+
+                const_iterator() : m_table { nullptr }, m_pos { 0 } { }
+                const_iterator(const StringTable * t, std::size_t pos) : m_table { t }, m_pos { pos } { }
+
+                std::string_view operator*() const { return (*m_table)[m_pos]; }
+                std::string_view operator[](difference_type n) const { return (*m_table)[m_pos + n]; }
+                const_iterator& operator++() { ++m_pos; return *this; }
+                const_iterator& operator--() { --m_pos; return *this; }
+                const_iterator operator++(int) { auto i = *this; ++m_pos; return i; }
+                const_iterator operator--(int) { auto i = *this; --m_pos; return i; }
+                const_iterator& operator+=(difference_type n) { m_pos += n; return *this; }
+                const_iterator& operator-=(difference_type n) { m_pos -= n; return *this; }
+                const_iterator operator+(difference_type n) const { return const_iterator(m_table, m_pos + n); }
+                const_iterator operator-(difference_type n) const { return const_iterator(m_table, m_pos - n); }
+                difference_type operator-(const const_iterator& o) const { return difference_type(m_pos) - difference_type(o.m_pos); }
+                bool operator==(const const_iterator& o) const { return m_pos == o.m_pos; }
+                bool operator!=(const const_iterator& o) const { return m_pos != o.m_pos; }
+                bool operator<(const const_iterator& o) const { return m_pos < o.m_pos; }
+                bool operator>(const const_iterator& o) const { return m_pos > o.m_pos; }
+                bool operator<=(const const_iterator& o) const { return m_pos <= o.m_pos; }
+                bool operator>=(const const_iterator& o) const { return m_pos >= o.m_pos; }
+
+            private:
+                const StringTable * m_table;
+                std::size_t m_pos;
+        };
+
+        StringTable();
+        StringTable(const StringTable& other);
+        StringTable(StringTable&& other);
+        StringTable& operator=(const StringTable& other);
+        StringTable& operator=(StringTable&& other);
+
+        std::size_t size() const { return m_count; }
+        bool empty() const { return m_count == 0; }
+        std::string_view operator[](std::size_t i) const { return { m_chars + m_refsData[i].offset, m_refsData[i].length }; }
+        std::string_view back() const { return (*this)[size() - 1]; }
+        const_iterator begin() const { return const_iterator(this, 0); }
+        const_iterator end() const { return const_iterator(this, size()); }
+
+        void reserve(std::size_t count, std::size_t bytes);
+        void push_back(std::string_view s);
+        void insert(std::size_t pos, std::string_view s);
+        void erase(std::size_t pos);
+        void append(const StringTable& other);
+        void clear();
+        void sort();
+
+        /* read the table from refs and chars, which owner keeps alive */
+        void borrow(std::shared_ptr<const void> owner, const Ref * refs, std::size_t count,
+                const char * chars, std::size_t bytes);
+
+        /* the table as it is stored, to write it out */
+        const Ref * refs() const { return m_refsData; }
+        const char * chars() const { return m_chars; }
+
+        /* bytes of string data, including those of erased strings not yet
+         * compacted away */
+        std::size_t dataSize() const { return m_bytes; }
+
+        /* bytes held, including unused capacity */
+        std::size_t capacityBytes() const;
+
+    private:
+        std::shared_ptr<const void> own();
+        void compact(const char * chars);
+        void sync();
+
+    private:
+        std::vector<char> m_blob;
+        std::vector<Ref>  m_refs;
+
+        /* where the elements are read from: the vectors above, or a
+         * borrowed table as long as m_owner is set */
+        std::shared_ptr<const void> m_owner;
+        const char * m_chars;
+        const Ref *  m_refsData;
+        std::size_t  m_count;
+        std::size_t  m_bytes;
+
+        /* bytes in m_blob left behind by erase() */
+        std::size_t  m_dead;
+};
+
+#endif /* !STRING_TABLE_H */
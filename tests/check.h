@@ -0,0 +1,110 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/*
+ * What the programs under tests/ share: a temporary directory removed on
+ * exit, a failure count, and a clock for the timings they report.
+ */
+namespace Check {
+
+static int failures { 0 };
+
+/* report a check, counting failures */
+static inline bool
+expect(bool ok, const std::string& what)
+{
+    std::cout << (ok ? "ok: " : "FAIL: ") << what << std::endl;
+    failures += !ok;
+    return ok;
+}
+
+/* what main() returns */
+static inline int
+status()
+{
+    return failures == 0 ? 0 : 1;
+}
+
+class TempDir {
+    public:
+        TempDir()
+        {
+            char dir[] { "/tmp/thingylaunch-check.XXXXXX" };
+            if (!mkdtemp(dir)) {
+                perror("mkdtemp");
+                exit(1);
+            }
+            m_path = dir;
+        }
+
+        ~TempDir()
+        {
+            std::string cmd { "/bin/rm -rf " + m_path };
+            if (system(cmd.c_str()) != 0) {
+                std::cerr << "couldn't remove " << m_path << std::endl;
+            }
+        }
+
+        const std::string& path() const { return m_path; }
+        std::string operator/(const std::string& name) const { return m_path + "/" + name; }
+
+    private:
+        std::string m_path;
+};
+
+/* create a file with the given contents and mode */
+static inline void
+writeFile(const std::string& file, const std::string& contents = std::string(), mode_t mode = 0644)
+{
+    std::ofstream { file, std::ios::binary | std::ios::trunc } << contents;
+    chmod(file.c_str(), mode);
+}
+
+/* milliseconds since start */
+static inline double
+elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+#endif /* !CHECK_H */
@@ -0,0 +1,128 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Parse color specifications as XParseColor would: names with spaces and
+ * in any case, #rgb in all four widths, rgb:r/g/b scaled to 16 bits, and
+ * malformed ones. Every name in the system's rgb.txt is checked too, if
+ * one is found.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+using namespace std;
+
+#include "check.h"
+#include "color_name.h"
+
+static string
+hex(const ColorName::RGB& rgb)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%04x/%04x/%04x", rgb.red, rgb.green, rgb.blue);
+    return buf;
+}
+
+static void
+parses(const string& spec, uint16_t red, uint16_t green, uint16_t blue)
+{
+    ColorName::RGB rgb { 1, 2, 3 };
+    ColorName::RGB expected { red, green, blue };
+    bool ok { ColorName::parse(spec, rgb) };
+    Check::expect(ok && hex(rgb) == hex(expected), "'" + spec + "' is " +
+            (ok ? hex(rgb) : "not a color") + (ok && hex(rgb) == hex(expected) ? "" : ", expected " + hex(expected)));
+}
+
+static void
+fails(const string& spec)
+{
+    ColorName::RGB rgb { 1, 2, 3 };
+    bool ok { ColorName::parse(spec, rgb) };
+    Check::expect(!ok && rgb.red == 1 && rgb.green == 2 && rgb.blue == 3,
+            "'" + spec + "' is not a color, and changes nothing");
+}
+
+int
+main()
+{
+    parses("black", 0, 0, 0);
+    parses("DarkSlateGray", 0x2f2f, 0x4f4f, 0x4f4f);
+    parses("dark slate gray", 0x2f2f, 0x4f4f, 0x4f4f);
+    parses("Light Goldenrod Yellow", 0xfafa, 0xfafa, 0xd2d2);
+    parses("gray100", 0xffff, 0xffff, 0xffff);
+
+    /* the digits are the top bits of each channel */
+    parses("#f80", 0xf000, 0x8000, 0x0000);
+    parses("#ff8000", 0xff00, 0x8000, 0x0000);
+    parses("#FFF80000F", 0xfff0, 0x8000, 0x00f0);
+    parses("#ffff80000001", 0xffff, 0x8000, 0x0001);
+
+    /* the digits are a fraction of the channel's range */
+    parses("rgb:f/0/80", 0xffff, 0x0000, 0x8080);
+    parses("rgb:ff/8/ABC", 0xffff, 0x8888, 0xabca);
+    parses("rgb:ffff/1/0001", 0xffff, 0x1111, 0x0001);
+
+    for (const char * spec : { "", "#", "#ff", "#ff80", "#fffffffffffffff", "#ggg", "#12 ",
+            "rgb:", "rgb:1/2", "rgb:1/2/", "rgb://3", "rgb:1/2/3/4", "rgb:12345/0/0",
+            "rgb:f/0/8g", "no such color", "grey101", "dark slate grey x" }) {
+        fails(spec);
+    }
+
+    /* everything the server knows by name, if its rgb.txt is around */
+    for (const char * file : { "/usr/share/X11/rgb.txt", "/usr/local/share/X11/rgb.txt",
+            "/usr/X11R6/lib/X11/rgb.txt" }) {
+        ifstream in { file };
+        if (!in) {
+            continue;
+        }
+        size_t count { 0 };
+        string bad;
+        string line;
+        while (getline(in, line)) {
+            istringstream fields { line };
+            unsigned r, g, b;
+            string name;
+            if (line.empty() || line[0] == '!' || !(fields >> r >> g >> b) ||
+                !getline(fields >> ws, name)) {
+                continue;
+            }
+            ColorName::RGB rgb;
+            ColorName::RGB expected { uint16_t(r * 0x101), uint16_t(g * 0x101), uint16_t(b * 0x101) };
+            if (!ColorName::parse(name, rgb) || hex(rgb) != hex(expected)) {
+                bad += " '" + name + "'";
+            }
+            ++count;
+        }
+        Check::expect(count > 0 && bad.empty(), "the " + to_string(count) + " names in " +
+                file + (bad.empty() ? "" : ", but not" + bad));
+        break;
+    }
+
+    return Check::status();
+}
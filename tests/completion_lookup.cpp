@@ -0,0 +1,166 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Time Tab completion on 10k and 1M synthetic executables, against the
+ * linear search with a string copy per probe it replaced, and check the
+ * order Tab and Shift-Tab go through the matches in. The names are put in
+ * the index cache for an empty $PATH directory, rather than made files.
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "completion.h"
+#include "fuzzy_matcher.h"
+#include "index_cache.h"
+#include "util.h"
+
+static string
+name(size_t i)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "tl%07zu", i);
+    return buf;
+}
+
+/* what Tab did: the first element starting with command, by value */
+static string
+linearNext(const vector<string>& elements, const string& command)
+{
+    auto matchPrefix = [&command] (string e) { return e.compare(0, command.size(), command) == 0; };
+    auto i = find_if(elements.begin(), elements.end(), matchPrefix);
+    return i == elements.end() ? command : *i;
+}
+
+static void
+run(const Check::TempDir& tmp, size_t count)
+{
+    /* an empty directory, and a cache entry for it with the names */
+    string dir { tmp / ("bin" + to_string(count)) };
+    mkdir(dir.c_str(), 0755);
+    struct timespec old[2] { { 1000000000, 0 }, { 1000000000, 0 } };
+    utimensat(AT_FDCWD, dir.c_str(), old, 0);
+
+    vector<string> elements;
+    vector<IndexCache::Dir> dirs(1);
+    dirs[0].path = dir;
+    stat(dir.c_str(), &dirs[0].sb);
+    vector<uint64_t> masks;
+    for (size_t i = 0; i < count; ++i) {
+        elements.push_back(name(i));
+        dirs[0].names.push_back(elements.back());
+        masks.push_back(FuzzyMatcher::charMask(elements.back()));
+    }
+    IndexCache { Util::getCacheDir() }.save(dirs, dirs[0].names, masks);
+    setenv("PATH", dir.c_str(), 1);
+
+    Completion comp;
+    comp.start(false, false);
+    vector<string> rows;
+    if (!Check::expect(comp.wait(chrono::seconds(30)) && comp.list("", 0, 0, rows) == count,
+                to_string(count) + ": index loaded")) {
+        return;
+    }
+
+    /* the same answers, random names all over the index */
+    mt19937 rng { 42 };
+    uniform_int_distribution<size_t> pick { 0, count - 1 };
+    vector<string> queries;
+    for (int i = 0; i < 100; ++i) {
+        queries.push_back(name(pick(rng)));
+    }
+
+    size_t linearQueries { count > 100000 ? 20u : queries.size() };
+    size_t sum { 0 };
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < linearQueries; ++i) {
+        sum += linearNext(elements, queries[i]).size();
+    }
+    double linearUs { Check::elapsed(start) * 1000 / linearQueries };
+
+    bool same { true };
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < 100; ++round) {
+        for (const auto& q : queries) {
+            comp.reset();
+            string n { comp.next(q) };
+            same = same && n == q;
+            sum += n.size();
+        }
+    }
+    double rangeUs { Check::elapsed(start) * 1000 / (100 * queries.size()) };
+
+    Check::expect(same, to_string(count) + ": Tab finds the name typed");
+    cout << count << " executables: linear " << linearUs << " us, range " << rangeUs << " us per Tab ("
+         << sum % 10 << ")" << endl;
+
+    /* the common prefix of the matches first */
+    comp.reset();
+    Check::expect(comp.next("tl") == (count == 10000 ? "tl000" : "tl0"),
+            to_string(count) + ": Tab fills in the common prefix");
+
+    /* then the matches in order, and back */
+    comp.reset();
+    string prefix { name(count / 2).substr(0, 8) };
+    vector<string> seen;
+    for (int i = 0; i < 11; ++i) {
+        seen.push_back(comp.next(prefix));
+    }
+    seen.push_back(comp.prev(prefix));
+    seen.push_back(comp.prev(prefix));
+    vector<string> expected;
+    for (int i = 0; i < 10; ++i) {
+        expected.push_back(prefix + char('0' + i));
+    }
+    expected.push_back(prefix + '0');
+    expected.push_back(prefix + '9');
+    expected.push_back(prefix + '8');
+    Check::expect(seen == expected, to_string(count) + ": Tab and Shift-Tab cycle through the matches in order");
+}
+
+int
+main()
+{
+    Check::TempDir tmp;
+    mkdir((tmp / "cache").c_str(), 0700);
+    setenv("XDG_CACHE_HOME", (tmp / "cache").c_str(), 1);
+
+    run(tmp, 10000);
+    run(tmp, 1000000);
+
+    return Check::status();
+}
@@ -0,0 +1,110 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Listen on the control socket, check that only its owner may use it,
+ * that requests get through, and that a socket left behind by a daemon
+ * that is gone is replaced while a live daemon's is not.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "check.h"
+#include "control_socket.h"
+
+static bool
+isSocket(const string& path, mode_t& mode)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) == -1) {
+        return false;
+    }
+    mode = sb.st_mode & 07777;
+    return S_ISSOCK(sb.st_mode);
+}
+
+/* bind a socket and close it, as a daemon that was killed leaves it */
+static bool
+leaveStale(const string& path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd { socket(AF_UNIX, SOCK_STREAM, 0) };
+    bool ok { bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0 &&
+              listen(fd, 1) == 0 };
+    close(fd);
+    return ok;
+}
+
+int
+main()
+{
+    Check::TempDir runtime;
+    setenv("XDG_RUNTIME_DIR", runtime.path().c_str(), 1);
+    string path { runtime / "thingylaunch.sock" };
+    mode_t mode;
+
+    Check::expect(!ControlSocket::send("show"), "no daemon, no request sent");
+
+    {
+        ControlSocket daemon;
+        Check::expect(daemon.listen() && isSocket(path, mode) && mode == 0600,
+                "listening, on a socket with mode 0600");
+
+        Check::expect(ControlSocket::send("show") && daemon.receive() == "show",
+                "a request gets through");
+
+        ControlSocket second;
+        Check::expect(!second.listen() && daemon.receive() == "ping",
+                "a second daemon pings the first and gives up");
+        Check::expect(ControlSocket::send("hide") && daemon.receive() == "hide",
+                "the first one still gets requests");
+    }
+    Check::expect(!isSocket(path, mode), "the socket is removed on exit");
+
+    Check::expect(leaveStale(path) && isSocket(path, mode) && !ControlSocket::send("ping"),
+            "a stale socket, no daemon behind it");
+    {
+        ControlSocket daemon;
+        Check::expect(daemon.listen() && isSocket(path, mode) && mode == 0600 &&
+                ControlSocket::send("show") && daemon.receive() == "show",
+                "is replaced by a new daemon's");
+    }
+
+    return Check::status();
+}
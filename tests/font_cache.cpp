@@ -0,0 +1,131 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Save and look up resolved fonts: a hit returns what was saved, with the
+ * hash of the font path it was resolved under, so a changed font path
+ * shows the entry is stale; a miss, an unreadable cache and the oldest
+ * pattern past the limit find nothing.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "check.h"
+#include "font_cache.h"
+#include "util.h"
+
+static FontCache::Font
+font(const string& name, int16_t ascent)
+{
+    FontCache::Font f;
+    f.name = name;
+    f.ascent = ascent;
+    f.descent = ascent / 4;
+    for (int i = 0; i < 256; ++i) {
+        f.widths[i] = ascent / 2 + i % 3;
+    }
+    return f;
+}
+
+static bool
+same(const FontCache::Font& a, const FontCache::Font& b)
+{
+    return a.name == b.name && a.ascent == b.ascent && a.descent == b.descent &&
+           memcmp(a.widths, b.widths, sizeof(a.widths)) == 0;
+}
+
+/* the hash of a font path, as X11XCB::fontPathHash() makes it */
+static uint64_t
+pathHash(initializer_list<string> path)
+{
+    uint64_t h { FontCache::hash("") };
+    for (const auto& p : path) {
+        h = FontCache::hash(p, h);
+    }
+    return h;
+}
+
+int
+main()
+{
+    Check::TempDir home;
+    setenv("XDG_CACHE_HOME", home.path().c_str(), 1);
+    FontCache cache;
+    FontCache::Font found;
+    uint64_t hash;
+
+    const string pattern { "-*-fixed-medium-r-*-*-13-*-*-*-*-*-iso8859-1" };
+    const auto fixed { font("-misc-fixed-medium-r-semicondensed--13-120-75-75-c-60-iso8859-1", 12) };
+    const uint64_t path { pathHash({ "/usr/share/fonts/X11/misc", "built-ins" }) };
+
+    Check::expect(!cache.lookup(pattern, found, hash), "a miss without a cache file");
+
+    Check::expect(cache.save(pattern, path, fixed) && cache.lookup(pattern, found, hash) &&
+            same(found, fixed) && hash == path, "a hit after saving, with the font path's hash");
+    Check::expect(!cache.lookup(pattern + " ", found, hash) && !cache.lookup("fixed", found, hash),
+            "a miss for other patterns");
+
+    /* the same elements differently split, or in another order, differ */
+    const uint64_t moved { pathHash({ "built-ins", "/usr/share/fonts/X11/misc" }) };
+    Check::expect(moved != path && pathHash({ "/usr/share/fonts/X11/mis", "cbuilt-ins" }) != path,
+            "a changed font path hashes differently");
+
+    /* stale: the caller resolves the pattern again and saves the result */
+    const auto other { font("-misc-fixed-medium-r-normal--13-120-75-75-c-70-iso8859-1", 11) };
+    Check::expect(cache.lookup(pattern, found, hash) && hash != moved &&
+            cache.save(pattern, moved, other) && cache.lookup(pattern, found, hash) &&
+            same(found, other) && hash == moved, "a stale entry is replaced");
+
+    /* the least recently saved patterns go first */
+    bool kept { true };
+    for (int i = 0; i < 7; ++i) {
+        kept = cache.save("pattern" + to_string(i), path, font("font" + to_string(i), i)) && kept;
+    }
+    kept = kept && cache.lookup(pattern, found, hash) && same(found, other);
+    kept = kept && cache.save(pattern, moved, other) && cache.save("pattern7", path, font("font7", 7));
+    Check::expect(kept && cache.lookup(pattern, found, hash) && !cache.lookup("pattern0", found, hash) &&
+            cache.lookup("pattern7", found, hash) && same(found, font("font7", 7)),
+            "eight patterns kept, the least recently saved dropped");
+
+    Check::expect(!cache.save(string(256, 'x'), path, fixed) &&
+            !cache.save(pattern, path, font(string(256, 'x'), 12)) &&
+            cache.lookup(pattern, found, hash) && same(found, other),
+            "names too long aren't saved, and leave the cache alone");
+
+    /* an unreadable cache is a miss, and is replaced on the next save */
+    string file { Util::getCacheDir() + "/fonts" };
+    Check::writeFile(file, "TLFC but not quite");
+    Check::expect(!cache.lookup(pattern, found, hash), "a miss on a broken cache file");
+    Check::expect(cache.save(pattern, path, fixed) && cache.lookup(pattern, found, hash) &&
+            same(found, fixed), "which the next save replaces");
+
+    return Check::status();
+}
@@ -0,0 +1,93 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Record launches from two Frecency instances, and from another process,
+ * and check that each sees the other's through score() and version().
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "check.h"
+#include "frecency.h"
+
+int
+main()
+{
+    Check::TempDir home;
+    setenv("HOME", home.path().c_str(), 1);
+    time_t now { time(nullptr) };
+
+    Frecency a;
+    Check::expect(!a.load() && a.version() == 0 && a.score("ls", now) == 0,
+            "nothing before the first launch");
+
+    a.add("ls -l");
+    a.add("  ls");
+    Check::expect(fabs(a.score("ls", now) - 2) < 0.01 && a.score("ls -l", now) == 0,
+            "launches count by command name");
+
+    /* another instance, in this process */
+    Frecency b;
+    Check::expect(b.load() && b.version() == a.version() && b.score("ls", now) == a.score("ls", now),
+            "a second instance loads the same table");
+    uint64_t before { a.version() };
+    b.add("vim notes");
+    Check::expect(a.version() != before && a.score("vim", now) > 0,
+            "the first instance sees the second's launch");
+
+    /* and in another process */
+    before = a.version();
+    pid_t pid { fork() };
+    if (pid == 0) {
+        Frecency c;
+        c.add("make check");
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    Check::expect(a.version() != before && b.version() == a.version() && a.score("make", now) > 0,
+            "both see another process's launch");
+
+    /* a file that isn't a table is replaced on the next launch */
+    Check::writeFile(home / ".thingylaunch.frecency", "not a table");
+    Frecency d;
+    Check::expect(!d.load(), "a file that isn't a table isn't loaded");
+    d.add("ls");
+    Check::expect(d.version() != 0 && fabs(d.score("ls", now) - 1) < 0.01,
+            "and is replaced by a new one on the next launch");
+
+    return Check::status();
+}
@@ -0,0 +1,202 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Check the order FuzzyMatcher ranks a fixed set of names in, that the
+ * SSE2 prefilter keeps what the scalar test would, for masks with bits on
+ * both sides of each 32-bit half and for odd counts that leave a scalar
+ * tail, and time a full rescore of 100k names against the 5 ms budget.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "fuzzy_matcher.h"
+#include "string_table.h"
+
+static void
+load(const vector<string>& names, StringTable& table, vector<uint64_t>& masks)
+{
+    table.clear();
+    masks.clear();
+    for (const auto& n : names) {
+        table.push_back(n);
+        masks.push_back(FuzzyMatcher::charMask(n));
+    }
+}
+
+/* the names match() returns, best first */
+static vector<string>
+ranked(FuzzyMatcher& matcher, const string& query, const vector<string>& names, size_t topK)
+{
+    StringTable table;
+    vector<uint64_t> masks;
+    load(names, table, masks);
+    vector<string> result;
+    for (const auto& m : matcher.match(query, table, masks, topK)) {
+        result.push_back(names[m.index]);
+    }
+    return result;
+}
+
+static string
+join(const vector<string>& v)
+{
+    string s;
+    for (const auto& e : v) {
+        s += (s.empty() ? "" : " ") + e;
+    }
+    return s;
+}
+
+static void
+checkOrder(FuzzyMatcher& matcher, const string& query, const vector<string>& names,
+        size_t topK, const vector<string>& expected)
+{
+    auto got { ranked(matcher, query, names, topK) };
+    Check::expect(got == expected, "'" + query + "' ranks " + join(got) +
+            (got == expected ? "" : ", expected " + join(expected)));
+}
+
+/*
+ * match() against scoring every name: the prefilter must not drop one,
+ * whatever position in its pair of masks it lands in.
+ */
+static bool
+sameAsScoringAll(FuzzyMatcher& matcher, const string& query, const vector<string>& names)
+{
+    StringTable table;
+    vector<uint64_t> masks;
+    load(names, table, masks);
+    size_t hits { 0 };
+    for (const auto& n : names) {
+        hits += matcher.score(query, n) >= 0;
+    }
+    auto got { matcher.match(query, table, masks, names.size()) };
+    if (got.size() != hits) {
+        return false;
+    }
+    for (const auto& m : got) {
+        if (m.score != matcher.score(query, names[m.index])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+main()
+{
+    FuzzyMatcher matcher;
+
+    /* the cases the request was about; earlier matches rank higher */
+    checkOrder(matcher, "ffx", { "ffmpeg", "firefox", "xfce4-terminal", "fixfiles" }, 10,
+            { "firefox" });
+    checkOrder(matcher, "code", { "decode", "xcode-select", "vscode", "code", "codium" }, 10,
+            { "code", "xcode-select", "decode", "vscode" });
+
+    /* a run at the start, then a camelCase hump over a longer gap to a boundary */
+    checkOrder(matcher, "gc", { "xgcc", "git-clone", "gitClone", "gc" }, 10,
+            { "gc", "gitClone", "git-clone", "xgcc" });
+
+    /* case doesn't matter; ties go to the shorter name, then the first one */
+    checkOrder(matcher, "ls", { "lsblk", "LS", "lsof", "ls" }, 10,
+            { "LS", "ls", "lsof", "lsblk" });
+
+    /* only the best topK */
+    checkOrder(matcher, "ls", { "lsblk", "LS", "lsof", "ls" }, 2, { "LS", "ls" });
+    Check::expect(matcher.score("", "ls") == 0 && matcher.score("lsof", "ls") < 0 &&
+            matcher.score("sl", "ls") < 0, "empty, longer and out-of-order queries");
+
+    /*
+     * Letters set mask bits 0-25, digits 26-35 and everything else 36-63:
+     * a query like "a9." has a bit in each 32-bit half of its mask. Names
+     * missing any one of the bits, in every position of odd and even sized
+     * sets, must still be told apart from those that have them all.
+     */
+    vector<string> edge { "a9.", "a9", "9.", "a.", ".a9", "A_9.x", "9", ".", "a",
+        "z8~", "a~9.", "~" };
+    bool same { true };
+    for (const auto& query : { "a9.", "a9", "9.", "a.", "~", "z8" }) {
+        for (size_t n = 1; n <= edge.size(); ++n) {
+            for (size_t rot = 0; rot < n; ++rot) {
+                vector<string> names(begin(edge), begin(edge) + n);
+                rotate(begin(names), begin(names) + rot, end(names));
+                same = same && sameAsScoringAll(matcher, query, names);
+            }
+        }
+    }
+    Check::expect(same, "prefilter keeps every match across both mask halves and the tail");
+
+    /* 100k names made of a few hundred parts, as /usr/bin looks */
+    mt19937 rng { 6 };
+    const vector<string> parts { "git", "x", "gnome", "kde", "lib", "config", "ls", "ff", "fire",
+        "fox", "code", "vs", "py", "thon", "3", "-", "_", ".", "tool", "run", "db", "ctl", "sh",
+        "perl", "5", "34", "open", "ssl", "qt", "gtk", "img", "to", "pdf", "zip", "un", "view" };
+    uniform_int_distribution<size_t> part { 0, parts.size() - 1 };
+    uniform_int_distribution<size_t> length { 1, 5 };
+    vector<string> names;
+    for (size_t i = 0; i < 100000; ++i) {
+        string n;
+        for (size_t l = length(rng); l > 0; --l) {
+            n += parts[part(rng)];
+        }
+        names.push_back(n);
+    }
+    StringTable table;
+    vector<uint64_t> masks;
+    load(names, table, masks);
+
+    Check::expect(sameAsScoringAll(matcher, "gtk", names) && sameAsScoringAll(matcher, "f3.", names),
+            "prefilter keeps every match on 100k names");
+
+    /* the slowest query, each timed at its best of ten runs */
+    double worst { 0 };
+    string worstQuery;
+    for (const auto& query : { "f", "ff", "ffx", "code", "gtk3", "pyth", "xsl", "cnfg.zip" }) {
+        double best { 1e9 };
+        for (int run = 0; run < 10; ++run) {
+            auto start { chrono::steady_clock::now() };
+            auto result { matcher.match(query, table, masks, 10) };
+            best = min(best, Check::elapsed(start));
+        }
+        if (best > worst) {
+            worst = best;
+            worstQuery = query;
+        }
+    }
+    Check::expect(worst < 5.0, "100k names rescored in " + to_string(worst) +
+            " ms at worst ('" + worstQuery + "'), budget 5 ms");
+
+    return Check::status();
+}
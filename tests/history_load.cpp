@@ -0,0 +1,129 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Time loading a 1M-line history file, against reading it line by line
+ * into strings as History used to, and check that only the newest
+ * entries up to the maximum size are visited.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "history.h"
+
+static constexpr size_t Lines { 1000000 };
+
+static string
+entry(size_t i)
+{
+    return "cmd" + to_string(i) + " --flag " + to_string(i % 977);
+}
+
+/* the time for the first prev(), which loads the file */
+static double
+load(size_t maxSize, string& newest)
+{
+    History h;
+    h.setMaxSize(maxSize);
+    auto start { chrono::steady_clock::now() };
+    auto e { h.prev() };
+    double ms { Check::elapsed(start) };
+    newest = e ? string(*e) : string();
+    return ms;
+}
+
+/* the first and last entries prev() visits, and how many there are */
+static bool
+visits(size_t maxSize, size_t& count, string& oldest)
+{
+    History h;
+    h.setMaxSize(maxSize);
+    count = 0;
+    while (auto e = h.prev()) {
+        oldest = *e;
+        ++count;
+    }
+    return count > 0;
+}
+
+int
+main()
+{
+    Check::TempDir home;
+    setenv("HOME", home.path().c_str(), 1);
+    string file { home / ".thingylaunch.history" };
+
+    {
+        ofstream out { file };
+        for (size_t i = 0; i < Lines; ++i) {
+            out << entry(i) << '\n';
+        }
+    }
+
+    /* what History did: a string per line, the whole file */
+    double linesMs { 1e9 };
+    for (int run = 0; run < 3; ++run) {
+        auto start { chrono::steady_clock::now() };
+        ifstream in { file };
+        vector<string> lines;
+        string line;
+        while (getline(in, line)) {
+            lines.push_back(line);
+        }
+        linesMs = min(linesMs, Check::elapsed(start));
+    }
+
+    /* best of ten runs, with the file in the page cache */
+    double fullMs { 1e9 };
+    double cappedMs { 1e9 };
+    string newest;
+    for (int run = 0; run < 10; ++run) {
+        fullMs = min(fullMs, load(Lines, newest));
+        cappedMs = min(cappedMs, load(History::DefaultMaxSize, newest));
+    }
+    Check::expect(newest == entry(Lines - 1), "the newest entry comes first");
+    Check::expect(fullMs < 10, to_string(Lines) + " lines: " + to_string(fullMs) +
+            " ms indexing all of them, " + to_string(cappedMs) + " ms the newest " +
+            to_string(History::DefaultMaxSize) + "; getline into strings " +
+            to_string(linesMs) + " ms");
+
+    size_t count;
+    string oldest;
+    Check::expect(visits(1000, count, oldest) && count == 1000 && oldest == entry(Lines - 1000),
+            "a maximum size of 1000 visits the newest 1000");
+    Check::expect(visits(Lines, count, oldest) && count == Lines && oldest == entry(0),
+            "a maximum size of " + to_string(Lines) + " visits all of them");
+
+    return Check::status();
+}
@@ -0,0 +1,173 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Check Up/Down navigation restricted to a prefix against filtering every
+ * entry: as the prefix is extended and shortened again, and at both ends
+ * of the matches, where navigation wraps to the typed command line.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "history.h"
+
+/* write the entries, oldest first, and return them newest first */
+static vector<string>
+write(const string& file, vector<string> entries)
+{
+    ofstream out { file, ios::trunc };
+    for (const auto& e : entries) {
+        out << e << '\n';
+    }
+    entries.erase(remove(begin(entries), end(entries), ""), end(entries));
+    reverse(begin(entries), end(entries));
+    return entries;
+}
+
+/* the entries Up visits with prefix, newest first, each once */
+static vector<string>
+matches(const vector<string>& entries, const string& prefix)
+{
+    if (prefix.empty()) {
+        return entries;
+    }
+    vector<string> result;
+    set<string> seen;
+    for (const auto& e : entries) {
+        if (e.compare(0, prefix.size(), prefix) == 0 && seen.insert(e).second) {
+            result.push_back(e);
+        }
+    }
+    return result;
+}
+
+static optional<string>
+str(optional<string_view> e)
+{
+    return e ? optional<string>(string(*e)) : nullopt;
+}
+
+/*
+ * Up through every match and past the oldest, back to the typed line, and
+ * around again; then Down from the typed line to the oldest, through every
+ * match and past the newest, back to the typed line, and around again.
+ */
+static bool
+navigate(History& h, const vector<string>& entries, const string& prefix)
+{
+    auto expected { matches(entries, prefix) };
+    h.setPrefix(prefix);
+    for (int lap = 0; lap < 2; ++lap) {
+        for (const auto& e : expected) {
+            if (str(h.prev()) != e) {
+                return false;
+            }
+        }
+        if (h.prev()) {
+            return false;
+        }
+    }
+    for (int lap = 0; lap < 2; ++lap) {
+        for (auto e = expected.rbegin(); e != expected.rend(); ++e) {
+            if (str(h.next()) != *e) {
+                return false;
+            }
+        }
+        if (h.next()) {
+            return false;
+        }
+    }
+
+    /* turning back at either end */
+    if (!expected.empty()) {
+        h.prev();
+        if (h.next() || str(h.next()) != expected.back() || h.prev()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+main()
+{
+    Check::TempDir home;
+    setenv("HOME", home.path().c_str(), 1);
+    string file { home / ".thingylaunch.history" };
+
+    auto entries { write(file, { "git status", "ls", "git stash", "", "git status", "gitk",
+            "git", "make", "git status", "ls -l", "g" }) };
+    {
+        History h;
+        Check::expect(navigate(h, entries, ""), "no prefix visits every entry");
+        Check::expect(navigate(h, entries, "git st") && navigate(h, entries, "git status"),
+                "repeated entries are visited once, the newest time");
+    }
+    {
+        History h;
+        bool ok { true };
+        for (const string p : { "g", "gi", "git", "git ", "git s", "git st", "git sta", "git stat",
+                "git stas", "git sta", "git st", "git", "gi", "g", "", "l", "ls", "ls ", "ls", "" }) {
+            ok = ok && navigate(h, entries, p);
+        }
+        Check::expect(ok, "a prefix extended and shortened again");
+        Check::expect(navigate(h, entries, "git stashes") && navigate(h, entries, "x") &&
+                navigate(h, entries, "git status "), "prefixes no entry starts with");
+    }
+
+    /* many entries, sharing prefixes of all lengths */
+    mt19937 rng { 13 };
+    vector<string> many;
+    for (int i = 0; i < 20000; ++i) {
+        string e;
+        for (int n = rng() % 6 + 1; n > 0; --n) {
+            e += "ab c"[rng() % 4];
+        }
+        many.push_back(e);
+    }
+    entries = write(file, many);
+    History h;
+    h.setMaxSize(many.size());
+    bool ok { true };
+    for (const string p : { "a", "ab", "ab ", "ab c", "ab c", "ab ", "b", "bb", "bbb", "bbbb",
+            "bbbbb", "bbbbbb", "bbbbbbb", "c c", "", " " }) {
+        ok = ok && navigate(h, entries, p);
+    }
+    Check::expect(ok, to_string(many.size()) + " entries, at both ends of each prefix");
+
+    return Check::status();
+}
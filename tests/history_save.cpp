@@ -0,0 +1,154 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Save entries to the history file from many processes at once, and check
+ * that none of them is lost or torn, with and without compaction.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+using namespace std;
+
+#include "history.h"
+
+static constexpr int Savers { 16 };
+static constexpr int Entries { 200 };
+
+/* an entry of varying length, which says how long it should be */
+static string
+entry(int saver, int n)
+{
+    string e { "tl" + to_string(saver) + "-" + to_string(n) + "-" };
+    size_t len { static_cast<size_t>((saver * 131 + n * 37) % 700) };
+    e += to_string(len) + ":" + string(len, 'a' + (saver + n) % 26);
+    return e;
+}
+
+static bool
+wellFormed(const string& line)
+{
+    auto colon = line.find(':');
+    auto dash = line.rfind('-', colon);
+    if (line.compare(0, 2, "tl") != 0 || colon == string::npos || dash == string::npos) {
+        return false;
+    }
+    size_t len { strtoul(line.c_str() + dash + 1, nullptr, 10) };
+    return line.size() == colon + 1 + len &&
+           line.find_first_not_of(line.back(), colon + 1) == string::npos;
+}
+
+/* run the savers, return the lines of the history file */
+static bool
+run(const string& file, size_t maxSize, multiset<string>& lines)
+{
+    remove(file.c_str());
+    for (int s = 0; s < Savers; ++s) {
+        if (fork() == 0) {
+            for (int n = 0; n < Entries; ++n) {
+                History h;
+                h.setMaxSize(maxSize);
+                h.save(entry(s, n));
+                h.save("");
+            }
+            _exit(0);
+        }
+    }
+
+    bool ok { true };
+    int status;
+    while (wait(&status) != -1) {
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    ifstream in { file };
+    string line;
+    while (getline(in, line)) {
+        lines.insert(line);
+    }
+    return ok;
+}
+
+int
+main()
+{
+    char dir[] { "/tmp/thingylaunch-check.XXXXXX" };
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("HOME", dir, 1);
+    string file { string(dir) + "/.thingylaunch.history" };
+    int failures { 0 };
+
+    /* everything fits: every entry must be there, once */
+    multiset<string> lines;
+    if (!run(file, Savers * Entries, lines)) {
+        cout << "FAIL: a saver failed" << endl;
+        ++failures;
+    }
+    size_t missing { 0 };
+    for (int s = 0; s < Savers; ++s) {
+        for (int n = 0; n < Entries; ++n) {
+            missing += lines.count(entry(s, n)) != 1;
+        }
+    }
+    if (missing || lines.size() != Savers * Entries) {
+        cout << "FAIL: " << missing << " entries lost or repeated, " << lines.size() << " lines" << endl;
+        ++failures;
+    } else {
+        cout << "ok: " << lines.size() << " entries from " << Savers << " savers" << endl;
+    }
+
+    /* compacted over and over: what is left must be whole and unique */
+    constexpr size_t maxSize { 100 };
+    lines.clear();
+    run(file, maxSize, lines);
+    size_t torn { 0 }, repeated { 0 };
+    for (auto i = lines.begin(); i != lines.end(); i = lines.upper_bound(*i)) {
+        torn += !wellFormed(*i);
+        repeated += lines.count(*i) > 1;
+    }
+    if (torn || repeated || lines.empty() || lines.size() > maxSize + maxSize / 2) {
+        cout << "FAIL: " << torn << " torn, " << repeated << " repeated, " << lines.size()
+             << " lines while compacting" << endl;
+        ++failures;
+    } else {
+        cout << "ok: " << lines.size() << " entries left while compacting" << endl;
+    }
+
+    remove(file.c_str());
+    rmdir(dir);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Check History::search() against scanning every entry, for queries too
+ * short for the trigram index, for trigrams most entries share, and as a
+ * query is typed a character at a time, and time each keystroke on 1M
+ * entries.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "history.h"
+
+static constexpr size_t Entries { 1000000 };
+
+/* the entries, newest first, as History indexes them */
+static vector<string>
+write(const string& file)
+{
+    mt19937 rng { 12 };
+    const vector<string> commands { "git commit -m 'fix ", "git push origin topic", "git log -p ",
+        "ls -la /tmp/", "make -j8 ", "vim src/file", "ssh host", "gitk --all ", "cd ~/src/" };
+    vector<string> entries;
+    ofstream out { file };
+    for (size_t i = 0; i < Entries; ++i) {
+        string e { commands[rng() % commands.size()] + to_string(rng() % 5000) };
+        out << e << '\n';
+        entries.push_back(e);
+    }
+    reverse(begin(entries), end(entries));
+    return entries;
+}
+
+/* the first entry at or after from containing query, or entries.size() */
+static size_t
+scan(const vector<string>& entries, const string& query, size_t from)
+{
+    while (from < entries.size() && entries[from].find(query) == string::npos) {
+        ++from;
+    }
+    return from;
+}
+
+/* the first count matches, going older, from search() and from scanning */
+static bool
+walk(History& h, const vector<string>& entries, const string& query, size_t count)
+{
+    h.resetSearch();
+    size_t id { 0 };
+    for (size_t i = 0; i < count; ++i) {
+        id = scan(entries, query, i == 0 ? 0 : id + 1);
+        auto found { h.search(query, i > 0) };
+        if (id == entries.size()) {
+            return !found;
+        }
+        if (!found || *found != entries[id]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+main()
+{
+    Check::TempDir home;
+    setenv("HOME", home.path().c_str(), 1);
+    auto entries { write(home / ".thingylaunch.history") };
+
+    History h;
+    h.setMaxSize(Entries);
+
+    auto start { chrono::steady_clock::now() };
+    h.search("push", false);
+    double buildMs { Check::elapsed(start) };
+
+    /* shorter than a trigram: scanned for without the index */
+    Check::expect(walk(h, entries, "4", 50) && walk(h, entries, "p ", 50) &&
+            walk(h, entries, "gi", 50), "one- and two-byte queries");
+    Check::expect(walk(h, entries, "m 'f", 5) && walk(h, entries, "-j8 49", 30) &&
+            walk(h, entries, "zzz", 2) && walk(h, entries, "k --all 4999", 1000),
+            "queries in few entries, and in none");
+
+    /* "git" is in more than half of the entries, "it " in a third */
+    Check::expect(walk(h, entries, "git", 1000) && walk(h, entries, "git ", 1000) &&
+            walk(h, entries, "git log -p 123", 1000) && walk(h, entries, "it l", 1000),
+            "trigrams most entries share");
+
+    /* typed a character at a time: each keystroke keeps the match if it
+     * still matches, else moves to an older one */
+    const string query { "ssh host4321" };
+    bool typed { true };
+    double worst { 0 };
+    h.resetSearch();
+    size_t id { 0 };
+    for (size_t n = 1; n <= query.size(); ++n) {
+        string q { query.substr(0, n) };
+        id = scan(entries, q, id);
+        start = chrono::steady_clock::now();
+        auto found { h.search(q, false) };
+        worst = max(worst, Check::elapsed(start));
+        typed = typed && (id == entries.size() ? !found : found && *found == entries[id]);
+    }
+    Check::expect(typed, "a query typed a character at a time");
+
+    /* and older matches of the whole query, with Ctrl-R */
+    for (int i = 0; i < 20; ++i) {
+        id = scan(entries, query, id + 1);
+        start = chrono::steady_clock::now();
+        auto found { h.search(query, true) };
+        worst = max(worst, Check::elapsed(start));
+        typed = typed && (id == entries.size() ? !found : found && *found == entries[id]);
+    }
+    Check::expect(typed, "older matches");
+
+    Check::expect(worst < 1, to_string(Entries) + " entries: index built in " +
+            to_string(buildMs) + " ms, " + to_string(worst) + " ms per keystroke at worst");
+
+    return Check::status();
+}
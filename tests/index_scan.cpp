@@ -0,0 +1,151 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Index a $PATH of tens of thousands of entries three ways: the way it
+ * used to be done, with a stat() of a built path per entry and a sort at
+ * the end, and by Completion, from scratch and from its cache. Check that
+ * they agree on tricky entries, and report how long each one took.
+ */
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "completion.h"
+
+static constexpr int Dirs { 8 };
+static constexpr int FilesPerDir { 5000 };
+
+/* what the old scanner did, minus its uid/gid check: stat() everything */
+static vector<string>
+naiveScan(const vector<string>& path)
+{
+    vector<string> names;
+    for (const auto& p : path) {
+        DIR * dirp { opendir(p.c_str()) };
+        if (!dirp) {
+            continue;
+        }
+        struct dirent * dp;
+        while ((dp = readdir(dirp))) {
+            string file { p + "/" + dp->d_name };
+            struct stat sb;
+            if (stat(file.c_str(), &sb) == 0 && S_ISREG(sb.st_mode) && access(file.c_str(), X_OK) == 0) {
+                names.push_back(dp->d_name);
+            }
+        }
+        closedir(dirp);
+    }
+    sort(names.begin(), names.end());
+    names.erase(unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+/* build the index, return all of it */
+static vector<string>
+index(bool rebuild, double& ms)
+{
+    auto start = chrono::steady_clock::now();
+    Completion comp;
+    comp.start(rebuild, false);
+    if (!comp.wait(chrono::seconds(30))) {
+        return { };
+    }
+    ms = Check::elapsed(start);
+    vector<string> rows;
+    comp.list("", 0, ~size_t(0), rows);
+    return rows;
+}
+
+int
+main()
+{
+    Check::TempDir tmp;
+    mkdir((tmp / "cache").c_str(), 0700);
+
+    vector<string> path;
+    string pathEnv;
+    for (int d = 0; d < Dirs; ++d) {
+        path.push_back(tmp / ("bin" + to_string(d)));
+        pathEnv += (d ? ":" : "") + path.back();
+        mkdir(path.back().c_str(), 0755);
+        for (int f = 0; f < FilesPerDir; ++f) {
+            /* a third of the names show up in two directories */
+            int n { f % 3 == 0 ? f : d * FilesPerDir + f };
+            Check::writeFile(path.back() + "/tl" + to_string(n), "", f % 10 == 9 ? 0644 : 0755);
+        }
+    }
+
+    /* what d_type alone doesn't tell */
+    Check::writeFile(path[0] + "/target", "", 0755);
+    symlink("target", (path[0] + "/tllink").c_str());
+    symlink("tl9", (path[0] + "/tllink-noexec").c_str());
+    symlink("nowhere", (path[0] + "/tllink-dangling").c_str());
+    symlink("..", (path[0] + "/tllink-dir").c_str());
+    mkdir((path[0] + "/tldir").c_str(), 0755);
+
+    /* directories modified in the last seconds aren't cached */
+    struct timespec old[2] { { 1000000000, 0 }, { 1000000000, 0 } };
+    for (const auto& p : path) {
+        utimensat(AT_FDCWD, p.c_str(), old, 0);
+    }
+
+    setenv("PATH", pathEnv.c_str(), 1);
+    setenv("XDG_CACHE_HOME", (tmp / "cache").c_str(), 1);
+
+    auto start = chrono::steady_clock::now();
+    auto expected = naiveScan(path);
+    double naiveMs { Check::elapsed(start) };
+
+    double coldMs { 0 }, warmMs { 0 };
+    auto cold = index(true, coldMs);
+    auto warm = index(false, warmMs);
+
+    Check::expect(cold == expected, "from scratch: " + to_string(cold.size()) + " of " +
+            to_string(expected.size()) + " executables");
+    Check::expect(warm == expected, "from the cache: " + to_string(warm.size()) + " of " +
+            to_string(expected.size()) + " executables");
+    Check::expect(binary_search(cold.begin(), cold.end(), "tllink") &&
+                  !binary_search(cold.begin(), cold.end(), "tllink-noexec") &&
+                  !binary_search(cold.begin(), cold.end(), "tllink-dangling") &&
+                  !binary_search(cold.begin(), cold.end(), "tllink-dir") &&
+                  !binary_search(cold.begin(), cold.end(), "tldir"),
+            "links to executables only, no directories");
+
+    cout << Dirs * FilesPerDir << " entries: stat() and sort " << naiveMs << " ms, from scratch "
+         << coldMs << " ms, from the cache " << warmMs << " ms" << endl;
+
+    return Check::status();
+}
@@ -0,0 +1,154 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Add and remove executables in temporary $PATH directories, and check
+ * that the completion index follows without being built again.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/inotify.h>)
+#define HAVE_INOTIFY 1
+#endif
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "completion.h"
+
+static string tmp;
+static int failures { 0 };
+
+static void
+touch(const string& name, bool executable)
+{
+    ofstream { tmp + "/" + name };
+    chmod((tmp + "/" + name).c_str(), executable ? 0755 : 0644);
+}
+
+static string
+join(const vector<string>& v)
+{
+    string s;
+    for (const auto& e : v) {
+        s += (s.empty() ? "" : " ") + e;
+    }
+    return s;
+}
+
+/* wait for the index to hold exactly the expected names */
+static void
+expect(Completion& comp, const string& step, const vector<string>& expected)
+{
+    vector<string> rows;
+    for (int i = 0; i < 200; ++i) {
+        comp.list("tlw", 0, 100, rows);
+        if (rows == expected) {
+            cout << "ok: " << step << endl;
+            return;
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    cout << "FAIL: " << step << ": expected [" << join(expected) << "], got [" << join(rows) << "]" << endl;
+    ++failures;
+}
+
+int
+main()
+{
+#ifndef HAVE_INOTIFY
+    cout << "skipped: no inotify" << endl;
+    return 0;
+#else
+    char dir[] { "/tmp/thingylaunch-check.XXXXXX" };
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    tmp = dir;
+    mkdir((tmp + "/a").c_str(), 0755);
+    mkdir((tmp + "/b").c_str(), 0755);
+    mkdir((tmp + "/cache").c_str(), 0755);
+    touch("a/tlwfoo", true);
+    setenv("PATH", (tmp + "/a:" + tmp + "/b").c_str(), 1);
+    setenv("XDG_CACHE_HOME", (tmp + "/cache").c_str(), 1);
+
+    Completion comp;
+    comp.start(true, false);
+    if (!comp.wait(chrono::seconds(5))) {
+        cout << "FAIL: the index was not built" << endl;
+        return 1;
+    }
+    expect(comp, "initial scan", { "tlwfoo" });
+
+    touch("b/tlwbar", true);
+    touch("b/tlwfoo", true);
+    touch("b/tlwdata", false);
+    expect(comp, "add", { "tlwbar", "tlwfoo" });
+
+    unlink((tmp + "/a/tlwfoo").c_str());
+    expect(comp, "remove one of two copies", { "tlwbar", "tlwfoo" });
+
+    unlink((tmp + "/b/tlwfoo").c_str());
+    chmod((tmp + "/b/tlwbar").c_str(), 0644);
+    expect(comp, "remove, chmod -x", { });
+
+    rename((tmp + "/b/tlwdata").c_str(), (tmp + "/a/tlwmoved").c_str());
+    chmod((tmp + "/a/tlwmoved").c_str(), 0755);
+    expect(comp, "move, chmod +x", { "tlwmoved" });
+
+    unlink((tmp + "/a/tlwmoved").c_str());
+    rmdir((tmp + "/a").c_str());
+    touch("b/tlwother", true);
+    expect(comp, "remove directory", { "tlwother" });
+
+    mkdir((tmp + "/a").c_str(), 0755);
+    touch("a/tlwback", true);
+    expect(comp, "recreate directory", { "tlwback", "tlwother" });
+
+    rename((tmp + "/b").c_str(), (tmp + "/old").c_str());
+    expect(comp, "move directory away", { "tlwback" });
+
+    rename((tmp + "/old").c_str(), (tmp + "/b").c_str());
+    touch("b/tlwnew", true);
+    expect(comp, "move directory back", { "tlwback", "tlwnew", "tlwother" });
+
+    string cmd { "/bin/rm -rf " + tmp };
+    system(cmd.c_str());
+    return failures == 0 ? 0 : 1;
+#endif
+}
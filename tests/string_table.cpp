@@ -0,0 +1,211 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Count the allocations and the bytes held by a vector<string> and by a
+ * StringTable of 6000 and of 1M names, and check that erasing and
+ * inserting keep the table's contents right and its blob at most twice
+ * what the live names need.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "string_table.h"
+
+/*
+ * Every allocation the program makes goes through these. The size is kept
+ * in front of the block, for delete to subtract it again.
+ */
+static size_t allocations { 0 };
+static size_t heldBytes { 0 };
+
+static constexpr size_t Header { alignof(max_align_t) };
+
+void *
+operator new(size_t size)
+{
+    auto p { static_cast<char *>(malloc(Header + size)) };
+    if (!p) {
+        throw bad_alloc();
+    }
+    *reinterpret_cast<size_t *>(p) = size;
+    ++allocations;
+    heldBytes += size;
+    return p + Header;
+}
+
+void
+operator delete(void * p) noexcept
+{
+    if (p) {
+        auto block { static_cast<char *>(p) - Header };
+        heldBytes -= *reinterpret_cast<size_t *>(block);
+        free(block);
+    }
+}
+
+void
+operator delete(void * p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+/* names of 2 to 30 characters, as /usr/bin has */
+static vector<string>
+names(size_t count)
+{
+    mt19937 rng { 8 };
+    const vector<string> parts { "git", "x", "gnome", "kde", "lib", "config", "ls", "fire", "fox",
+        "code", "py", "thon", "3", "-", "_", ".", "tool", "run", "db", "ctl", "sh", "perl",
+        "5", "34", "open", "ssl", "qt", "gtk", "img", "to", "pdf", "zip", "un", "view" };
+    uniform_int_distribution<size_t> part { 0, parts.size() - 1 };
+    uniform_int_distribution<size_t> length { 1, 6 };
+    vector<string> result;
+    result.reserve(count);
+    while (result.size() < count) {
+        string n { parts[part(rng)] };
+        for (size_t l = length(rng); l > 1 && n.size() < 24; --l) {
+            n += parts[part(rng)];
+        }
+        result.push_back(n);
+    }
+    return result;
+}
+
+static void
+measure(const vector<string>& src)
+{
+    string what { to_string(src.size()) + " names: " };
+
+    size_t allocs { allocations };
+    size_t held { heldBytes };
+    {
+        auto v { make_unique<vector<string>>() };
+        for (const auto& n : src) {
+            v->push_back(string(n.data(), n.size()));
+        }
+        allocs = allocations - allocs;
+        held = heldBytes - held;
+    }
+
+    size_t tableAllocs { allocations };
+    size_t tableHeld { heldBytes };
+    {
+        auto t { make_unique<StringTable>() };
+        for (const auto& n : src) {
+            t->push_back(n);
+        }
+        tableAllocs = allocations - tableAllocs;
+        tableHeld = heldBytes - tableHeld;
+    }
+
+    Check::expect(tableAllocs < 100 && tableAllocs < allocs && tableHeld < held, what +
+            "vector<string> " + to_string(allocs) + " allocations, " + to_string(held / 1024) +
+            " KB; StringTable " + to_string(tableAllocs) + " allocations, " +
+            to_string(tableHeld / 1024) + " KB");
+}
+
+static bool
+same(const StringTable& t, const vector<string>& v)
+{
+    return t.size() == v.size() && equal(t.begin(), t.end(), v.begin());
+}
+
+static size_t
+liveBytes(const vector<string>& v)
+{
+    size_t bytes { 0 };
+    for (const auto& n : v) {
+        bytes += n.size();
+    }
+    return bytes;
+}
+
+int
+main()
+{
+    measure(names(6000));
+    measure(names(1000000));
+
+    /* random inserts and erases, as the inotify watcher makes them */
+    auto pool { names(20000) };
+    vector<string> model(begin(pool), begin(pool) + 2000);
+    StringTable table;
+    for (const auto& n : model) {
+        table.push_back(n);
+    }
+    mt19937 rng { 8 };
+    bool contents { true };
+    bool bounded { true };
+    size_t largest { table.dataSize() };
+    for (size_t step = 0; step < 20000; ++step) {
+        /* shrink to a handful of names, then grow back */
+        bool shrinking { (step / 5000) % 2 == 0 };
+        if (!model.empty() && (shrinking ? rng() % 10 != 0 : rng() % 10 == 0)) {
+            size_t pos { rng() % model.size() };
+            model.erase(begin(model) + pos);
+            table.erase(pos);
+        } else {
+            size_t pos { rng() % (model.size() + 1) };
+            const string& n { pool[rng() % pool.size()] };
+            model.insert(begin(model) + pos, n);
+            table.insert(pos, n);
+        }
+        contents = contents && same(table, model);
+        bounded = bounded && table.dataSize() <= 2 * liveBytes(model);
+        largest = max(largest, table.dataSize());
+    }
+    Check::expect(contents, "contents after 20000 inserts and erases");
+    Check::expect(bounded, "blob at most twice the live names, " + to_string(largest) +
+            " bytes at most, " + to_string(table.dataSize()) + " now for " +
+            to_string(liveBytes(model)) + " live");
+
+    /* a borrowed table's unused bytes are left behind when it is copied */
+    string chars { "..bin..sh....tool" };
+    vector<StringTable::Ref> refs { { 2, 3 }, { 7, 2 }, { 13, 4 } };
+    StringTable borrowed;
+    borrowed.borrow(make_shared<int>(0), refs.data(), refs.size(), chars.data(), chars.size());
+    borrowed.erase(1);
+    Check::expect(same(borrowed, { "bin", "tool" }) && borrowed.dataSize() == 9,
+            "a borrowed table is compacted when copied");
+
+    /* sorting after compaction still compares the right characters */
+    table.sort();
+    sort(begin(model), end(model));
+    Check::expect(same(table, model), "sorted after compaction");
+
+    return Check::status();
+}
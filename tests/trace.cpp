@@ -0,0 +1,179 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Built with THINGYLAUNCH_TRACE, record nested phases in two threads and
+ * check the Chrome trace counts each phase's own syscalls and round
+ * trips. Built without it, check that no trace code made it into this
+ * program, nor into thingylaunch if it was built alongside.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "trace.h"
+
+#ifdef THINGYLAUNCH_TRACE
+
+/* the line of the trace with the event called name */
+static string
+event(const vector<string>& lines, const string& name)
+{
+    for (const auto& l : lines) {
+        if (l.find("{\"name\":\"" + name + "\"") == 0) {
+            return l;
+        }
+    }
+    return string();
+}
+
+static bool
+has(const string& event, const string& what)
+{
+    return event.find(what) != string::npos;
+}
+
+int
+main()
+{
+    Check::TempDir tmp;
+    string file { tmp / "trace.json" };
+    Trace::enable(Trace::Format_Chrome, file);
+
+    long grab { TRACE_BEGIN("grab") };
+    long running { TRACE_BEGIN("running") };
+    TRACE_END(running);
+    {
+        TRACE_PHASE("outer");
+        TRACE_SYSCALLS(2);
+        {
+            TRACE_PHASE("inner");
+            TRACE_SYSCALLS(3);
+            TRACE_ROUNDTRIP();
+        }
+        TRACE_ROUNDTRIP();
+        TRACE_ROUNDTRIP();
+
+        /* another thread's phases are its own, not nested in ours */
+        thread t { [] {
+            TRACE_PHASE("worker");
+            TRACE_SYSCALLS(5);
+        } };
+        t.join();
+    }
+    TRACE_SYSCALLS(7);
+    long left { TRACE_BEGIN("left running") };
+    (void)left;
+    TRACE_END(grab);
+    TRACE_FINISH();
+
+    /* charged to nothing once finished */
+    TRACE_SYSCALLS(1);
+
+    ifstream in { file };
+    vector<string> lines;
+    string line;
+    while (getline(in, line)) {
+        lines.push_back(line);
+    }
+
+    string outer { event(lines, "outer") };
+    string inner { event(lines, "inner") };
+    string worker { event(lines, "worker") };
+    Check::expect(lines.size() == 8 && has(lines.front(), "traceEvents"),
+            "a Chrome trace with six events");
+    Check::expect(has(outer, "\"syscalls\":2,\"roundtrips\":2,\"running\":false") &&
+            has(inner, "\"syscalls\":3,\"roundtrips\":1,\"running\":false"),
+            "nested phases count their own syscalls and round trips");
+    Check::expect(has(worker, "\"tid\":1,") && has(worker, "\"syscalls\":5,") &&
+            has(outer, "\"tid\":0,"), "a thread's phases count on their own");
+    Check::expect(has(event(lines, "grab"), "\"syscalls\":7,\"roundtrips\":0,\"running\":false") &&
+            has(event(lines, "running"), "\"syscalls\":0,\"roundtrips\":0,\"running\":false") &&
+            has(event(lines, "left running"), "\"syscalls\":0,\"roundtrips\":0,\"running\":true"),
+            "phases begun and ended by hand, and one still running");
+
+    return Check::status();
+}
+
+#else /* !THINGYLAUNCH_TRACE */
+
+/* the symbols in program whose names mention trace */
+static string
+traceSymbols(const string& program)
+{
+    string cmd { "nm -C " + program + " 2>/dev/null" };
+    FILE * nm { popen(cmd.c_str(), "r") };
+    if (!nm) {
+        return "?";
+    }
+    string found;
+    size_t lines { 0 };
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), nm)) {
+        string l { buf };
+        ++lines;
+        if (l.find("Trace::") != string::npos || l.find("trace.cpp") != string::npos) {
+            found += l;
+        }
+    }
+    return pclose(nm) == 0 && lines > 0 ? found : "?";
+}
+
+int
+main(int, char ** argv)
+{
+    /* the macros still work as statements and expressions */
+    {
+        TRACE_PHASE("phase");
+        TRACE_SYSCALLS(1);
+        TRACE_ROUNDTRIP();
+    }
+    long index { TRACE_BEGIN("begin") };
+    TRACE_END(index);
+    TRACE_FINISH();
+    Check::expect(index == -1, "TRACE_BEGIN is -1");
+
+    string symbols { traceSymbols(argv[0]) };
+    Check::expect(symbols.empty(), "no trace symbols in " + string(argv[0]) +
+            (symbols == "?" ? ": couldn't run nm" : symbols.empty() ? "" : ":\n" + symbols));
+
+    ifstream prog { "thingylaunch" };
+    if (prog) {
+        symbols = traceSymbols("./thingylaunch");
+        Check::expect(symbols.empty(), "no trace symbols in thingylaunch" +
+                (symbols == "?" ? ": couldn't run nm" : symbols.empty() ? "" : ":\n" + symbols));
+    }
+
+    return Check::status();
+}
+
+#endif /* THINGYLAUNCH_TRACE */
@@ -0,0 +1,603 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Count the round trips thingylaunch makes to set up its window and to
+ * redraw it, against a fake X server that answers every request after a
+ * fixed latency, as a remote display would. Time spent waiting is counted
+ * in multiples of that latency: setup should take a single round trip once
+ * the font is cached, three when it has to be resolved, and redrawing
+ * none at all.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "check.h"
+#include "x11_interface.h"
+
+/* bytes in the client's byte order, which is ours */
+class Bytes {
+    public:
+        Bytes& u8(uint8_t v) { m_data.push_back(v); return *this; }
+        Bytes& u16(uint16_t v) { return raw(&v, sizeof(v)); }
+        Bytes& u32(uint32_t v) { return raw(&v, sizeof(v)); }
+        Bytes& zero(size_t n) { m_data.resize(m_data.size() + n); return *this; }
+        Bytes& pad() { return zero((4 - m_data.size() % 4) % 4); }
+        Bytes& str(const string& s) { u8(s.size()); return raw(s.data(), s.size()); }
+        Bytes& raw(const void * p, size_t n)
+        {
+            auto b { static_cast<const uint8_t *>(p) };
+            m_data.insert(m_data.end(), b, b + n);
+            return *this;
+        }
+        void set16(size_t at, uint16_t v) { memcpy(&m_data[at], &v, sizeof(v)); }
+        void set32(size_t at, uint32_t v) { memcpy(&m_data[at], &v, sizeof(v)); }
+        size_t size() const { return m_data.size(); }
+        const vector<uint8_t>& data() const { return m_data; }
+
+    private:
+        vector<uint8_t> m_data;
+};
+
+/*
+ * Just enough of an X server for thingylaunch: one TrueColor screen, one
+ * font, and replies to the requests it makes. Everything it sends goes
+ * out Latency after the request it answers came in.
+ */
+class FakeServer {
+    public:
+        static constexpr int Latency { 40 }; /* ms */
+
+        FakeServer();
+        ~FakeServer();
+        const string& display() const { return m_display; }
+        void setFontPath(const vector<string>& path);
+
+        /* requests since the last call, by opcode, and how many had replies,
+         * once the client has been quiet for a while */
+        map<uint8_t, size_t> requests(size_t& replies);
+
+    private:
+        struct Client {
+            int fd { -1 };
+            bool setUp { false };
+            uint16_t sequence { 0 };
+            vector<uint8_t> in;
+        };
+
+        struct Pending {
+            chrono::steady_clock::time_point due;
+            vector<uint8_t> bytes;
+        };
+
+        bool listen(int n);
+        void run();
+        void handle(Client& c, chrono::steady_clock::time_point now);
+        bool request(Client& c, const uint8_t * req, size_t len, Bytes& out);
+        static Bytes setupReply();
+        static Bytes reply(uint16_t sequence, uint8_t data, const Bytes& fixed, const Bytes& extra);
+
+    private:
+        string m_display;
+        string m_path;
+        int m_listen[2] { -1, -1 };
+        int m_wake[2] { -1, -1 };
+        thread m_thread;
+
+        mutex m_lock;
+        vector<string> m_fontPath;
+        map<uint8_t, size_t> m_requests;
+        size_t m_replies { 0 };
+        chrono::steady_clock::time_point m_lastRead;
+
+        static constexpr uint32_t Root { 0x100 };
+        static constexpr uint32_t Colormap { 0x20 };
+        static constexpr uint32_t Visual { 0x21 };
+        static constexpr uint8_t MinKeycode { 8 };
+        static constexpr uint8_t MaxKeycode { 255 };
+};
+
+FakeServer::FakeServer()
+    : m_fontPath { "/usr/share/fonts/X11/misc", "built-ins" }
+{
+    if (pipe(m_wake) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+
+    /* a display nobody uses: its socket, and on Linux the abstract one
+     * libxcb tries first */
+    if (mkdir("/tmp/.X11-unix", 0700) == 0) {
+        chmod("/tmp/.X11-unix", 01777);
+    }
+    for (int n = 90; n < 200 && m_display.empty(); ++n) {
+        if (listen(n)) {
+            m_display = ":" + to_string(n);
+        }
+    }
+    if (m_display.empty()) {
+        cerr << "no free display" << endl;
+        exit(1);
+    }
+
+    m_thread = thread { [this] { run(); } };
+}
+
+FakeServer::~FakeServer()
+{
+    if (write(m_wake[1], "", 1) != 1) {
+        perror("write");
+    }
+    m_thread.join();
+    for (int fd : { m_listen[0], m_listen[1], m_wake[0], m_wake[1] }) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    unlink(m_path.c_str());
+}
+
+bool
+FakeServer::listen(int n)
+{
+    string path { "/tmp/.X11-unix/X" + to_string(n) };
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) == 0) {
+        return false;
+    }
+
+    vector<string> names { path };
+#ifdef __linux__
+    names.push_back(string(1, '\0') + path);
+#endif
+    int fds[2] { -1, -1 };
+    for (size_t i = 0; i < names.size(); ++i) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, names[i].data(), names[i].size());
+        socklen_t len = offsetof(struct sockaddr_un, sun_path) + names[i].size() + (i == 0);
+        fds[i] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (bind(fds[i], reinterpret_cast<struct sockaddr *>(&addr), len) == -1 || ::listen(fds[i], 4) == -1) {
+            for (int fd : fds) {
+                if (fd != -1) {
+                    close(fd);
+                }
+            }
+            if (i > 0) {
+                unlink(path.c_str());
+            }
+            return false;
+        }
+    }
+
+    m_path = path;
+    m_listen[0] = fds[0];
+    m_listen[1] = fds[1];
+    return true;
+}
+
+void
+FakeServer::setFontPath(const vector<string>& path)
+{
+    lock_guard<mutex> guard { m_lock };
+    m_fontPath = path;
+}
+
+map<uint8_t, size_t>
+FakeServer::requests(size_t& replies)
+{
+    /* what the client flushed is in the socket, but maybe not read yet */
+    this_thread::sleep_for(chrono::milliseconds(Latency / 2));
+    for (;;) {
+        {
+            lock_guard<mutex> guard { m_lock };
+            if (chrono::steady_clock::now() - m_lastRead > chrono::milliseconds(Latency / 2)) {
+                break;
+            }
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    lock_guard<mutex> guard { m_lock };
+    replies = m_replies;
+    m_replies = 0;
+    return move(m_requests);
+}
+
+/*
+ * Serve one client at a time, holding back what is sent to it until it is
+ * due.
+ */
+void
+FakeServer::run()
+{
+    Client client;
+    deque<Pending> pending;
+
+    for (;;) {
+        auto now { chrono::steady_clock::now() };
+        while (!pending.empty() && pending.front().due <= now) {
+            const auto& b { pending.front().bytes };
+            if (client.fd != -1 && write(client.fd, b.data(), b.size()) != ssize_t(b.size())) {
+                perror("fake server write");
+            }
+            pending.pop_front();
+        }
+
+        int timeout { -1 };
+        if (!pending.empty()) {
+            auto wait { chrono::duration_cast<chrono::milliseconds>(pending.front().due - now).count() };
+            timeout = int(wait) + 1;
+        }
+
+        vector<struct pollfd> fds { { m_wake[0], POLLIN, 0 } };
+        if (client.fd != -1) {
+            fds.push_back({ client.fd, POLLIN, 0 });
+        } else {
+            for (int fd : m_listen) {
+                if (fd != -1) {
+                    fds.push_back({ fd, POLLIN, 0 });
+                }
+            }
+        }
+        if (poll(fds.data(), fds.size(), timeout) == -1) {
+            continue;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+
+        for (size_t i = 1; i < fds.size(); ++i) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            if (client.fd == -1) {
+                client = Client();
+                client.fd = accept(fds[i].fd, nullptr, nullptr);
+                break;
+            }
+
+            uint8_t buf[65536];
+            ssize_t n { read(client.fd, buf, sizeof(buf)) };
+            if (n <= 0) {
+                close(client.fd);
+                client = Client();
+                pending.clear();
+                break;
+            }
+            client.in.insert(client.in.end(), buf, buf + n);
+            {
+                lock_guard<mutex> guard { m_lock };
+                m_lastRead = chrono::steady_clock::now();
+            }
+
+            Bytes out;
+            size_t used { 0 };
+            while (used < client.in.size()) {
+                const uint8_t * p { client.in.data() + used };
+                size_t avail { client.in.size() - used };
+                size_t len;
+                if (!client.setUp) {
+                    /* byte order, pad, version, auth name and data lengths */
+                    if (avail < 12) {
+                        break;
+                    }
+                    uint16_t nameLen, dataLen;
+                    memcpy(&nameLen, p + 6, 2);
+                    memcpy(&dataLen, p + 8, 2);
+                    len = 12 + (nameLen + 3) / 4 * 4 + (dataLen + 3) / 4 * 4;
+                    if (avail < len) {
+                        break;
+                    }
+                    auto setup { setupReply() };
+                    out.raw(setup.data().data(), setup.size());
+                    client.setUp = true;
+                } else {
+                    if (avail < 4) {
+                        break;
+                    }
+                    uint16_t words;
+                    memcpy(&words, p + 2, 2);
+                    len = words * 4;
+                    if (len == 0 || avail < len) {
+                        break;
+                    }
+                    ++client.sequence;
+                    request(client, p, len, out);
+                }
+                used += len;
+            }
+            client.in.erase(client.in.begin(), client.in.begin() + used);
+
+            if (out.size()) {
+                pending.push_back({ chrono::steady_clock::now() + chrono::milliseconds(Latency), out.data() });
+            }
+        }
+    }
+
+    if (client.fd != -1) {
+        close(client.fd);
+    }
+}
+
+Bytes
+FakeServer::setupReply()
+{
+    const string vendor { "thingylaunch check" };
+    Bytes b;
+    b.u8(1).u8(0).u16(11).u16(0).u16(0);
+    b.u32(1).u32(0x00400000).u32(0x001fffff).u32(256);
+    b.u16(vendor.size()).u16(65535).u8(1).u8(2);
+    b.u8(0).u8(0).u8(32).u8(32).u8(MinKeycode).u8(MaxKeycode).zero(4);
+    b.raw(vendor.data(), vendor.size()).pad();
+
+    /* pixmap formats: depth, bits per pixel, scanline pad */
+    b.u8(1).u8(1).u8(32).zero(5);
+    b.u8(24).u8(32).u8(32).zero(5);
+
+    /* the screen, with a single TrueColor visual */
+    b.u32(Root).u32(Colormap).u32(0xffffff).u32(0).u32(0);
+    b.u16(1920).u16(1080).u16(508).u16(286).u16(1).u16(1);
+    b.u32(Visual).u8(0).u8(0).u8(24).u8(1);
+    b.u8(24).u8(0).u16(1).zero(4);
+    b.u32(Visual).u8(4).u8(8).u16(256).u32(0xff0000).u32(0x00ff00).u32(0x0000ff).zero(4);
+
+    b.set16(6, (b.size() - 8) / 4);
+    return b;
+}
+
+/* a reply: the 24 bytes after its header, and what follows them */
+Bytes
+FakeServer::reply(uint16_t sequence, uint8_t data, const Bytes& fixed, const Bytes& extra)
+{
+    Bytes b;
+    b.u8(1).u8(data).u16(sequence).u32(0);
+    b.raw(fixed.data().data(), min<size_t>(fixed.size(), 24)).zero(24 - min<size_t>(fixed.size(), 24));
+    b.raw(extra.data().data(), extra.size()).pad();
+    b.set32(4, (b.size() - 32) / 4);
+    return b;
+}
+
+/*
+ * Answer a request, if it has a reply. Return whether it had one.
+ */
+bool
+FakeServer::request(Client& c, const uint8_t * req, size_t len, Bytes& out)
+{
+    /* the requests thingylaunch makes without expecting a reply */
+    static const set<uint8_t> noReply { 1, 2, 4, 8, 10, 12, 18, 25, 32, 33, 34, 42, 45, 46, 53, 54,
+        55, 56, 60, 61, 62, 66, 67, 70, 72, 74, 76, 77 };
+
+    uint8_t opcode { req[0] };
+    {
+        lock_guard<mutex> guard { m_lock };
+        ++m_requests[opcode];
+        m_replies += !noReply.count(opcode);
+    }
+    if (noReply.count(opcode)) {
+        return false;
+    }
+
+    Bytes fixed, extra;
+    uint8_t data { 0 };
+    switch (opcode) {
+    case 16: /* InternAtom */
+        fixed.u32(300 + c.sequence);
+        break;
+    case 31: /* GrabKeyboard: Success */
+        break;
+    case 43: /* GetInputFocus */
+        data = 1;
+        fixed.u32(Root);
+        break;
+    case 47: { /* QueryFont: 256 characters 6 pixels wide */
+        Bytes info;
+        info.u16(0).u16(6).u16(6).u16(10).u16(3).u16(0);
+        extra.raw(info.data().data(), info.size()).zero(4);
+        extra.raw(info.data().data(), info.size()).zero(4);
+        extra.u16(0).u16(255).u16(0).u16(0);
+        extra.u8(0).u8(0).u8(0).u8(1).u16(10).u16(3).u32(256);
+        for (int i = 0; i < 256; ++i) {
+            extra.raw(info.data().data(), info.size());
+        }
+        /* the first 24 bytes go into the fixed part */
+        Bytes head;
+        head.raw(extra.data().data(), 24);
+        Bytes rest;
+        rest.raw(extra.data().data() + 24, extra.size() - 24);
+        fixed = head;
+        extra = rest;
+        break;
+    }
+    case 48: /* QueryTextExtents: 6 pixels per character */
+        fixed.u16(10).u16(3).u16(10).u16(3).u32(6 * ((len - 8) / 2)).u32(0).u32(6 * ((len - 8) / 2));
+        break;
+    case 49: /* ListFonts */
+        fixed.u16(1);
+        extra.str("-misc-fixed-medium-r-semicondensed--13-120-75-75-c-60-iso8859-1");
+        break;
+    case 52: { /* GetFontPath */
+        lock_guard<mutex> guard { m_lock };
+        fixed.u16(m_fontPath.size());
+        for (const auto& p : m_fontPath) {
+            extra.str(p);
+        }
+        break;
+    }
+    case 85: /* AllocNamedColor */
+        fixed.u32(0x123456).u16(0x1212).u16(0x3434).u16(0x5656).u16(0x1212).u16(0x3434).u16(0x5656);
+        break;
+    case 98: /* QueryExtension: none */
+        break;
+    case 101: { /* GetKeyboardMapping: letters on the usual keycodes, two per key */
+        uint8_t first { req[4] };
+        uint8_t count { req[5] };
+        data = 2;
+        const map<uint8_t, char> letters { { 38, 'a' }, { 56, 'b' }, { 54, 'c' }, { 40, 'd' },
+            { 26, 'e' }, { 43, 'h' }, { 46, 'l' }, { 32, 'o' }, { 27, 'r' }, { 25, 'w' } };
+        for (unsigned k = first; k < unsigned(first) + count; ++k) {
+            auto l { letters.find(k) };
+            extra.u32(l == letters.end() ? 0 : l->second).u32(l == letters.end() ? 0 : l->second - 'a' + 'A');
+        }
+        break;
+    }
+    case 119: /* GetModifierMapping: Shift, Lock, Control, Mod1 */
+        data = 1;
+        extra.u8(50).u8(66).u8(37).u8(64).zero(4);
+        break;
+    default: {
+        /* an Implementation error, for whatever else */
+        cerr << "fake server: unexpected request " << int(opcode) << endl;
+        Bytes e;
+        e.u8(0).u8(17).u16(c.sequence).u32(0).u16(0).u8(opcode).zero(21);
+        out.raw(e.data().data(), e.size());
+        return true;
+    }
+    }
+
+    auto r { reply(c.sequence, data, fixed, extra) };
+    out.raw(r.data().data(), r.size());
+    return true;
+}
+
+/* the latencies f waited for */
+template <typename F>
+static long
+roundTrips(F&& f, double& ms)
+{
+    auto start { chrono::steady_clock::now() };
+    f();
+    ms = Check::elapsed(start);
+    return lround(ms / FakeServer::Latency);
+}
+
+static string
+describe(long trips, double ms, long expected)
+{
+    return to_string(trips) + " round trip" + (trips == 1 ? "" : "s") + " (" + to_string(ms) +
+           " ms at " + to_string(FakeServer::Latency) + " ms each)" +
+           (trips == expected ? "" : ", expected " + to_string(expected));
+}
+
+/*
+ * Set up a window, and check the round trips it took: one to connect,
+ * setupTrips to set up, and none for the redraws after typing a command.
+ */
+static void
+session(FakeServer& server, const string& what, const string& fg, const string& renderFont, long setupTrips)
+{
+#ifdef THINGYLAUNCH_RENDER
+    /* the server is asked whether it has RENDER first */
+    setupTrips += !renderFont.empty();
+#endif
+    X11Interface * x { X11Interface::create() };
+    double ms;
+    size_t replies;
+
+    long trips { roundTrips([&] { Check::expect(x->createWindow(-1, -1, 400, 30, 5), what + ": window"); }, ms) };
+    Check::expect(trips == 1, what + ": connected in " + describe(trips, ms, 1));
+
+    bool ok { false };
+    trips = roundTrips([&] { ok = x->setupGC("black", fg, "fixed", renderFont); }, ms);
+    Check::expect(ok && trips == setupTrips, what + ": set up in " + describe(trips, ms, setupTrips));
+
+    x->show();
+    x->requestGrab();
+    auto grabbed { chrono::steady_clock::now() };
+    X11Interface::GrabStatus grab;
+    while ((grab = x->grabStatus()) == X11Interface::Grab_Pending && Check::elapsed(grabbed) < 5000) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    Check::expect(grab == X11Interface::Grab_Success, what + ": keyboard grabbed");
+    server.requests(replies);
+
+    /* type a command, move around in it, and show a list */
+    const string command { "echo hello world" };
+    trips = roundTrips([&] {
+        for (size_t n = 0; n <= command.size(); ++n) {
+            ok = x->redraw(command.substr(0, n), n, n % 2 ? "busy" : "") && ok;
+        }
+        for (size_t pos = command.size(); pos-- > 0; ) {
+            ok = x->redraw(command, pos, "") && ok;
+        }
+        x->setList({ "echo", "ed", "env" }, 0, 1);
+        ok = x->redraw("e", 1, "3 matches") && ok;
+    }, ms);
+    auto requests { server.requests(replies) };
+    Check::expect(ok && trips == 0 && replies == 0 && requests[76] > 0 && requests[62] > 0,
+            what + ": " + to_string(2 * command.size() + 2) + " redraws in " + describe(trips, ms, 0) +
+            ", " + to_string(replies) + " requests with replies, " + to_string(requests[76]) + " ImageText8, " + to_string(requests[62]) + " CopyArea");
+
+    delete x;
+}
+
+int
+main()
+{
+    Check::TempDir home;
+    setenv("HOME", home.path().c_str(), 1);
+    setenv("XDG_CACHE_HOME", home.path().c_str(), 1);
+    setenv("XAUTHORITY", (home / "Xauthority").c_str(), 1);
+
+    FakeServer server;
+    setenv("DISPLAY", server.display().c_str(), 1);
+
+    /* the font is resolved: ListFonts, then OpenFont and QueryFont */
+    session(server, "font not cached", "white", "", 3);
+
+    /* a color the server has to resolve costs nothing extra */
+    session(server, "font cached", "server only color", "", 1);
+
+    /* the server has no RENDER, the cached core font is drawn with */
+    session(server, "font cached, -xft", "white", "monospace", 1);
+
+    /* the font is resolved again once the font path changed */
+    server.setFontPath({ "/usr/local/share/fonts/misc", "built-ins" });
+    session(server, "font path changed", "white", "", 3);
+    session(server, "font cached again", "white", "", 1);
+
+    return Check::status();
+}
@@ -26,20 +26,29 @@
 #include <X11/X.h>
 #include <X11/keysym.h>
 
-#include <libgen.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <sstream>
 #include <string>
+#include <vector>
 using namespace std;
 
 #include "bookmark.h"
 #include "completion.h"
+#include "control_socket.h"
+#include "file_completion.h"
+#include "frecency.h"
 #include "history.h"
+#include "trace.h"
 #include "util.h"
 #include "x11_interface.h"
 
@@ -56,8 +65,30 @@ class Thingylaunch {
         void usage(const char * progname);
         void setupGC();
         void eventLoop();
-        void grabKeyboard();
+        bool handleEvent(X11Event& ev);
+        void startDaemon();
+        void show();
+        void hide();
+        void updateGrab();
+        int grabWait();
+        int render();
+        static bool parseHotkey(const string& spec, uint16_t& keysym, uint16_t& modifiers);
         bool keypress(X11Event& ev);
+        bool searchKeypress(X11Event& ev);
+        static bool isModifier(uint32_t key);
+        static bool isPrintable(uint32_t ch);
+        static string encodeChar(uint32_t ch);
+        static size_t prevChar(const string& s, size_t pos);
+        static size_t nextChar(const string& s, size_t pos);
+        void navigateHistory(bool older);
+        void search(bool older);
+        bool completionReady(chrono::milliseconds timeout);
+        void complete();
+        void resetCompletion();
+        void updateList();
+        void moveSelection(long delta);
+        bool acceptSelection();
+        string status();
         void execcmd();
         void die(string msg);
 
@@ -73,20 +104,98 @@ class Thingylaunch {
         string m_fgColorName;
         string m_bgColorName;
         vector<string> m_fontDesc;
+        string m_xftFont;
         string m_x, m_y, m_w, m_h;
+        string m_matchMode;
+        string m_histSize;
+        string m_hotkey;
+        string m_grabTimeout;
+        string m_maxFps;
+        string m_listSize;
+        bool m_rebuildIndex;
+        bool m_verbose;
+        bool m_daemon;
+        bool m_show;
+        bool m_traceStartup;
+        string m_traceJson;
+
+        /* Daemon mode: whether the window is shown, the hotkey toggling
+         * it, and the socket other instances ask to show it through */
+        bool m_visible;
+        uint16_t m_hotkeySym;
+        uint16_t m_hotkeyMods;
+        ControlSocket m_control;
+
+        /* Redrawing once per batch of events, at most once per frame
+         * interval if there is one, and how that went for -v */
+        bool m_dirty;
+        unsigned m_batchEvents;
+        unsigned long m_events;
+        unsigned long m_batches;
+        unsigned long m_redraws;
+        std::chrono::steady_clock::duration m_frameInterval;
+        std::chrono::steady_clock::time_point m_nextFrame;
+
+        /* Waiting for the keyboard: whether a grab request is out, when
+         * the next one goes out if not, and how long to back off after it */
+        bool m_grabbing;
+        bool m_grabInFlight;
+        unsigned m_grabAttempts;
+        std::chrono::steady_clock::time_point m_grabStart;
+        std::chrono::steady_clock::time_point m_grabRetry;
+        std::chrono::milliseconds m_grabDelay;
+        std::chrono::milliseconds m_grabLimit;
+        long m_grabTrace;
 
         /* Completion, history, and bookmarks */
-        Completion m_comp;
-        History    m_hist;
-        Bookmark   m_book;
+        Completion     m_comp;
+        FileCompletion m_files;
+        History        m_hist;
+        Frecency       m_frecency;
+        Bookmark       m_book;
 
         /* The command */
         string m_command;
         string::size_type m_cursorPos;
 
+        /* Up/Down history navigation: the command line as it was typed */
+        bool m_navigating;
+        string m_navSaved;
+        string::size_type m_navSavedPos;
+
+        /* Ctrl-R history search: the query, whether it matched, and the
+         * command line to restore when the search is cancelled */
+        bool m_searching;
+        bool m_searchFailed;
+        string m_searchQuery;
+        string m_searchSaved;
+        string::size_type m_searchSavedPos;
+
+        /* Tab was pressed while the completion index was being built */
+        bool m_pendingTab;
+        bool m_reverseTab;
+
+        /* The dropdown list of the commands matching the first word: how
+         * many rows it shows, the word it was last shown for, the first
+         * match shown, the selected one if any, and how many there are */
+        size_t m_listRows;
+        string m_listWord;
+        size_t m_listTop;
+        size_t m_listSelected;
+        size_t m_listTotal;
+        static constexpr int MaxListRows { 100 };
+
         /* The window size */
         static constexpr int WindowWidth { 640 };
         static constexpr int WindowHeight { 25 };
+
+        /* How long Tab blocks waiting for the completion index */
+        static constexpr std::chrono::milliseconds TabWait { 100 };
+
+        /* Backing off between keyboard grab attempts */
+        static constexpr std::chrono::milliseconds GrabDelay { 1 };
+        static constexpr std::chrono::milliseconds MaxGrabDelay { 64 };
+        static constexpr int DefaultGrabTimeout { 3000 };
 };
 
 Thingylaunch::Thingylaunch()
@@ -94,11 +203,46 @@ Thingylaunch::Thingylaunch()
       m_fgColorName { "white" },
       m_bgColorName { "black" },
       m_fontDesc { "*", "*", "medium", "r", "*", "*", "15", "*", "*", "*", "*", "*", "*", "*" },
-      m_cursorPos { 0 }
+      m_matchMode { "prefix" },
+      m_hotkey { "Mod4+space" },
+      m_rebuildIndex { false },
+      m_verbose { false },
+      m_daemon { false },
+      m_show { false },
+      m_traceStartup { false },
+      m_visible { false },
+      m_hotkeySym { 0 },
+      m_hotkeyMods { 0 },
+      m_dirty { false },
+      m_batchEvents { 0 },
+      m_events { 0 },
+      m_batches { 0 },
+      m_redraws { 0 },
+      m_frameInterval { 0 },
+      m_grabbing { false },
+      m_grabInFlight { false },
+      m_grabAttempts { 0 },
+      m_grabDelay { GrabDelay },
+      m_grabLimit { DefaultGrabTimeout },
+      m_grabTrace { -1 },
+      m_cursorPos { 0 },
+      m_navigating { false },
+      m_navSavedPos { 0 },
+      m_searching { false },
+      m_searchFailed { false },
+      m_searchSavedPos { 0 },
+      m_pendingTab { false },
+      m_reverseTab { false },
+      m_listRows { 0 },
+      m_listTop { 0 },
+      m_listSelected { string::npos },
+      m_listTotal { 0 }
 { }
 
 Thingylaunch::~Thingylaunch()
 {
+    m_comp.notify(nullptr);
+    m_files.notify(nullptr);
     delete m_x11;
 }
 
@@ -128,19 +272,118 @@ Thingylaunch::run(int argc, char **argv)
         return;
     }
 
-    if (!m_x11->createWindow(parseInt(m_x), parseInt(m_y), parseInt(m_w, WindowWidth), parseInt(m_h, WindowHeight))) {
+    if (m_traceStartup || !m_traceJson.empty()) {
+#ifdef THINGYLAUNCH_TRACE
+        Trace::enable(m_traceJson.empty() ? Trace::Format_Summary : Trace::Format_Chrome, m_traceJson);
+#else
+        die("Startup tracing is not compiled in, rebuild with make TRACE=1");
+#endif
+    }
+
+    /* just ask the daemon to show up */
+    if (m_show) {
+        if (!ControlSocket::send("show")) {
+            die("No daemon running");
+        }
+        return;
+    }
+
+    if (m_matchMode == "fuzzy") {
+        m_comp.setMatchMode(Completion::Match_Fuzzy);
+    } else if (m_matchMode != "prefix") {
+        usage(argv[0]);
+        return;
+    }
+
+    if (!m_histSize.empty()) {
+        int histSize { parseInt(m_histSize) };
+        if (histSize <= 0) {
+            usage(argv[0]);
+            return;
+        }
+        m_hist.setMaxSize(histSize);
+    }
+
+    if (!m_grabTimeout.empty()) {
+        int grabTimeout { parseInt(m_grabTimeout) };
+        if (grabTimeout < 0) {
+            usage(argv[0]);
+            return;
+        }
+        m_grabLimit = chrono::milliseconds(grabTimeout);
+    }
+
+#ifndef THINGYLAUNCH_RENDER
+    if (!m_xftFont.empty()) {
+        die("Anti-aliased text is not compiled in, rebuild with make RENDER=1");
+    }
+#endif
+
+    if (!m_maxFps.empty()) {
+        int maxFps { parseInt(m_maxFps) };
+        if (maxFps < 0) {
+            usage(argv[0]);
+            return;
+        }
+        if (maxFps > 0) {
+            m_frameInterval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::seconds(1)) / maxFps;
+        }
+    }
+
+    if (!m_listSize.empty()) {
+        int listRows { parseInt(m_listSize) };
+        if (listRows < 0 || listRows > MaxListRows) {
+            usage(argv[0]);
+            return;
+        }
+        m_listRows = listRows;
+    }
+
+    /* rank completions by how often and how recently they were launched */
+    {
+        TRACE_PHASE("load frecency");
+        m_frecency.load();
+        m_comp.setFrecency(&m_frecency);
+    }
+
+    /* build the completion index while the window comes up */
+    {
+        TRACE_PHASE("start completion");
+        m_comp.start(m_rebuildIndex, m_verbose);
+    }
+
+    if (!m_x11->createWindow(parseInt(m_x), parseInt(m_y), parseInt(m_w, WindowWidth), parseInt(m_h, WindowHeight),
+                m_listRows)) {
         die("Couldn't open window");
     }
 
-    if (!m_x11->setupGC(m_bgColorName, m_fgColorName, parseFontDesc())) {
-        die("Couldn't setup GC");
+    if (!m_x11->setupGC(m_bgColorName, m_fgColorName, parseFontDesc(), m_xftFont)) {
+        die("Couldn't setup the window, its font, or its colors");
+    }
+    if (m_verbose && !m_xftFont.empty() && !m_x11->antialiased()) {
+        cerr << "text: no render extension or no font matching " << m_xftFont << ", using the core font" << endl;
     }
 
-    if (!m_x11->grabKeyboard()) {
-        die ("Couldn't grab keyboard");
+    if (m_daemon) {
+        {
+            TRACE_PHASE("start daemon");
+            startDaemon();
+        }
+        TRACE_FINISH();
+    } else {
+        /* the trace is written once the keyboard is grabbed */
+        show();
     }
 
+    m_comp.notify([this] { m_x11->wakeup(); });
+    m_files.notify([this] { m_x11->wakeup(); });
+
     eventLoop();
+
+    if (m_verbose) {
+        cerr << "events: " << m_events << " in " << m_batches << " batch(es), "
+             << m_redraws << " redraw(s)" << endl;
+    }
 }
 
 int
@@ -166,6 +409,11 @@ Thingylaunch::readOptions(int argc, char **argv)
     continue; \
 }
 
+#define setFlag(varName) { \
+    (varName) = true; \
+    continue; \
+}
+
     vector<string> args;
     copy(argv+1, argv+argc, back_inserter(args));
 
@@ -217,6 +465,11 @@ Thingylaunch::readOptions(int argc, char **argv)
             setParam(m_fontDesc[6]); 
         }
 
+        /* anti-aliased font, a fontconfig pattern */
+        if (s == "-xft") {
+            setParam(m_xftFont);
+        }
+
         /* window x-coordinate */
         if (s == "-x") {
             setParam(m_x);
@@ -237,6 +490,66 @@ Thingylaunch::readOptions(int argc, char **argv)
             setParam(m_h);
         }
 
+        /* completion matching mode */
+        if (s == "-match") {
+            setParam(m_matchMode);
+        }
+
+        /* maximum number of history entries */
+        if (s == "-histsize") {
+            setParam(m_histSize);
+        }
+
+        /* stay resident, shown by a hotkey or -show */
+        if (s == "-daemon") {
+            setFlag(m_daemon);
+        }
+
+        /* ask the daemon to show up */
+        if (s == "-show") {
+            setFlag(m_show);
+        }
+
+        /* the daemon's hotkey */
+        if (s == "-hotkey") {
+            setParam(m_hotkey);
+        }
+
+        /* how long to wait for the keyboard */
+        if (s == "-grabtimeout") {
+            setParam(m_grabTimeout);
+        }
+
+        /* the rows of the dropdown list */
+        if (s == "-list") {
+            setParam(m_listSize);
+        }
+
+        /* the most redraws per second */
+        if (s == "-maxfps") {
+            setParam(m_maxFps);
+        }
+
+        /* ignore the executables index cache */
+        if (s == "-rebuild-index") {
+            setFlag(m_rebuildIndex);
+        }
+
+        /* print where the startup time goes */
+        if (s == "-trace-startup") {
+            setFlag(m_traceStartup);
+        }
+
+        /* write the startup trace in the Chrome trace event format */
+        if (s == "-trace-json") {
+            setParam(m_traceJson);
+        }
+
+        /* verbose */
+        if (s == "-v") {
+            setFlag(m_verbose);
+        }
+
         usage(argv[0]);
         return false;
     }
@@ -257,57 +570,357 @@ Thingylaunch::usage(const char * progname)
         "[-fwn font_width_name] "
         "[-fsn font_style_name] "
         "[-fpt font_point_size] "
+        "[-xft fontconfig_pattern] "
         "[-x window x-coordinate] "
         "[-y window y-coordinate] "
         "[-w window width] "
-        "[-h window height]\n";
+        "[-h window height] "
+        "[-match prefix|fuzzy] "
+        "[-histsize entries] "
+        "[-daemon [-hotkey modifiers+key]] "
+        "[-show] "
+        "[-grabtimeout milliseconds] "
+        "[-maxfps frames] "
+        "[-list rows] "
+        "[-rebuild-index] "
+        "[-trace-startup] "
+        "[-trace-json file] "
+        "[-v]\n";
 }
 
 void
 Thingylaunch::eventLoop()
 {
-    X11Event ev;
+    struct pollfd fds[] {
+        { m_x11->fd(), POLLIN, 0 },
+        { m_control.fd(), POLLIN, 0 }
+    };
+    nfds_t nfds { m_control.fd() == -1 ? 1u : 2u };
+
+    for (;;) {
+        /* handle everything that came in with a single read, so a flood
+         * of events can't keep us from drawing */
+        X11Event ev;
+        bool read { true };
+        while (m_x11->pollEvent(ev, read)) {
+            if (read) {
+                ++m_batches;
+            }
+            read = false;
+            ++m_batchEvents;
+            ++m_events;
+            if (!handleEvent(ev)) {
+                return;
+            }
+        }
+
+        if (!m_x11->connected()) {
+            return;
+        }
+
+        updateGrab();
+
+        /* sleep until the next grab attempt or the next frame is due */
+        int grabTimeout { grabWait() };
+        int frameTimeout { render() };
+        int timeout { grabTimeout == -1 ? frameTimeout :
+                      frameTimeout == -1 ? grabTimeout : min(grabTimeout, frameTimeout) };
+
+        /* the replies waited for above may have brought events along,
+         * which poll() wouldn't wake up for */
+        if (m_x11->pollEvent(ev, false)) {
+            ++m_batches;
+            ++m_batchEvents;
+            ++m_events;
+            if (!handleEvent(ev)) {
+                return;
+            }
+            continue;
+        }
+
+        if (poll(fds, nfds, timeout) == -1 && errno != EINTR) {
+            die("Couldn't poll");
+        }
+
+        if (nfds > 1 && (fds[1].revents & POLLIN)) {
+            if (m_control.receive() == "show" && !m_visible) {
+                show();
+            }
+        }
+    }
+}
+
+/*
+ * Handle an event, return whether to go on.
+ */
+bool
+Thingylaunch::handleEvent(X11Event& ev)
+{
+    switch (ev.type) {
+        case X11Event::EventType::Evt_Expose:
+            /* served from the back buffer */
+            return true;
+
+        case X11Event::EventType::Evt_KeyPress:
+            if (keypress(ev)) {
+                if (!m_daemon) {
+                    return false;
+                }
+                hide();
+            }
+            break;
+
+        case X11Event::EventType::Evt_Hotkey:
+            if (m_visible) {
+                hide();
+            } else {
+                show();
+            }
+            return true;
 
-    if (!m_x11->redraw(m_command, m_cursorPos)) {
+        case X11Event::EventType::Evt_Wakeup:
+            if (m_pendingTab && completionReady(chrono::milliseconds(0))) {
+                complete();
+            }
+            break;
+
+        case X11Event::EventType::Evt_Other:
+            return true;
+    }
+
+    /* drawn once the batch is handled */
+    m_dirty = true;
+
+    return true;
+}
+
+/*
+ * Redraw once for all the events handled since the last frame, and no
+ * sooner than a frame interval after it. Return how long to wait for the
+ * frame if it's held back, -1 otherwise.
+ */
+int
+Thingylaunch::render()
+{
+    if (!m_dirty) {
+        return -1;
+    }
+
+    auto now = chrono::steady_clock::now();
+    if (now < m_nextFrame) {
+        auto wait = chrono::ceil<chrono::milliseconds>(m_nextFrame - now);
+        return wait.count();
+    }
+
+    m_dirty = false;
+    if (!m_visible) {
+        return -1;
+    }
+
+    updateList();
+    if (!m_x11->redraw(m_command, m_cursorPos, status())) {
         die("Couldn't redraw");
     }
+    ++m_redraws;
+    if (m_verbose && m_x11->frameBytes()) {
+        cerr << "redraw: " << m_x11->frameBytes() << " bytes, " << m_batchEvents << " event(s)" << endl;
+    }
+    m_batchEvents = 0;
+    m_nextFrame = now + m_frameInterval;
 
-    while (m_x11->nextEvent(ev)) {
+    return -1;
+}
 
-        switch (ev.type) {
-            case X11Event::EventType::Evt_Expose:
-                break;
+/*
+ * Stay around with the window hidden, to be shown by the hotkey or by a
+ * request on the control socket.
+ */
+void
+Thingylaunch::startDaemon()
+{
+    if (!parseHotkey(m_hotkey, m_hotkeySym, m_hotkeyMods)) {
+        die("Invalid hotkey " + m_hotkey);
+    }
+    if (!m_x11->grabHotkey(m_hotkeySym, m_hotkeyMods)) {
+        die("Couldn't grab hotkey " + m_hotkey);
+    }
 
-            case X11Event::EventType::Evt_KeyPress:
-                if (keypress(ev)) {
-                    return;
+    if (!m_control.listen()) {
+        die("Couldn't listen on the control socket, is a daemon already running?");
+    }
+
+    /* don't leave zombies behind */
+    signal(SIGCHLD, SIG_IGN);
+}
+
+/*
+ * Show the window with an empty command line. The map, the keyboard grab,
+ * and the drawing all go out together, the event loop collects the grab.
+ */
+void
+Thingylaunch::show()
+{
+    m_command.clear();
+    m_cursorPos = 0;
+    m_navigating = false;
+    m_searching = false;
+    resetCompletion();
+
+    m_grabbing = true;
+    m_grabInFlight = true;
+    m_grabAttempts = 1;
+    m_grabStart = chrono::steady_clock::now();
+    m_grabDelay = GrabDelay;
+    m_grabTrace = TRACE_BEGIN("grab keyboard");
+
+    m_x11->show();
+    m_x11->requestGrab();
+    updateList();
+    if (!m_x11->redraw(m_command, m_cursorPos, status())) {
+        die("Couldn't redraw");
+    }
+    m_visible = true;
+}
+
+void
+Thingylaunch::hide()
+{
+    if (m_grabbing) {
+        m_grabbing = false;
+        TRACE_END(m_grabTrace);
+    }
+    m_x11->hide();
+    m_visible = false;
+}
+
+/*
+ * Collect the answer to the keyboard grab request, and ask again once the
+ * back-off delay is over. Another client, usually the window manager, can
+ * hold the keyboard for a while.
+ */
+void
+Thingylaunch::updateGrab()
+{
+    if (!m_grabbing) {
+        return;
+    }
+
+    auto now = chrono::steady_clock::now();
+    if (m_grabInFlight) {
+        switch (m_x11->grabStatus()) {
+            case X11Interface::Grab_Pending:
+                return;
+
+            case X11Interface::Grab_Success:
+                m_grabbing = false;
+                TRACE_END(m_grabTrace);
+                TRACE_FINISH();
+                if (m_verbose) {
+                    chrono::duration<double, milli> elapsed { now - m_grabStart };
+                    cerr << "grab: " << elapsed.count() << "ms, " << m_grabAttempts << " attempt(s)" << endl;
                 }
-                break;
+                return;
 
-            case X11Event::EventType::Evt_Other:
+            case X11Interface::Grab_Failed:
+                m_grabInFlight = false;
+                if (now - m_grabStart >= m_grabLimit) {
+                    if (!m_daemon) {
+                        die("Couldn't grab keyboard");
+                    }
+                    cerr << "Error: Couldn't grab keyboard" << endl;
+                    hide();
+                    return;
+                }
+                m_grabRetry = now + m_grabDelay;
+                m_grabDelay = min(m_grabDelay * 2, MaxGrabDelay);
                 break;
         }
+    }
 
-        if (!m_x11->redraw(m_command, m_cursorPos)) {
-            die("Couldn't redraw");
+    if (now >= m_grabRetry) {
+        m_x11->requestGrab();
+        m_grabInFlight = true;
+        ++m_grabAttempts;
+    }
+}
+
+/*
+ * How long poll() may sleep: until the next grab attempt if one is due,
+ * forever otherwise. Replies and events wake it up anyway.
+ */
+int
+Thingylaunch::grabWait()
+{
+    if (!m_grabbing || m_grabInFlight) {
+        return -1;
+    }
+    auto wait = chrono::ceil<chrono::milliseconds>(m_grabRetry - chrono::steady_clock::now());
+    return max(int(wait.count()), 0);
+}
+
+/*
+ * Parse a hotkey like Mod4+space or Control+Mod1+l.
+ */
+bool
+Thingylaunch::parseHotkey(const string& spec, uint16_t& keysym, uint16_t& modifiers)
+{
+    static const map<string, uint16_t> modifierNames {
+        { "Shift", ShiftMask }, { "Control", ControlMask }, { "Ctrl", ControlMask },
+        { "Mod1", Mod1Mask }, { "Alt", Mod1Mask }, { "Mod2", Mod2Mask }, { "Mod3", Mod3Mask },
+        { "Mod4", Mod4Mask }, { "Super", Mod4Mask }, { "Mod5", Mod5Mask }
+    };
+    static const map<string, uint16_t> keyNames {
+        { "space", XK_space }, { "Return", XK_Return }, { "Tab", XK_Tab }, { "Escape", XK_Escape },
+        { "F1", XK_F1 }, { "F2", XK_F2 }, { "F3", XK_F3 }, { "F4", XK_F4 }, { "F5", XK_F5 }, { "F6", XK_F6 },
+        { "F7", XK_F7 }, { "F8", XK_F8 }, { "F9", XK_F9 }, { "F10", XK_F10 }, { "F11", XK_F11 }, { "F12", XK_F12 }
+    };
+
+    modifiers = 0;
+    string::size_type start { 0 }, plus;
+    while ((plus = spec.find('+', start)) != string::npos) {
+        auto m = modifierNames.find(spec.substr(start, plus - start));
+        if (m == modifierNames.end()) {
+            return false;
         }
+        modifiers |= m->second;
+        start = plus + 1;
+    }
+
+    string key { spec.substr(start) };
+    auto k = keyNames.find(key);
+    if (k != keyNames.end()) {
+        keysym = k->second;
+    } else if (key.size() == 1 && isgraph(static_cast<unsigned char>(key[0]))) {
+        keysym = tolower(static_cast<unsigned char>(key[0]));
+    } else {
+        return false;
     }
+
+    return true;
 }
 
 bool
 Thingylaunch::keypress(X11Event& ev)
 {
-    /* check for a Shift-key meaning capital letter */
-    if (ev.state & ShiftMask) {
-        ev.key  = toupper(ev.key);
+    /* keys that don't belong to the search end it and act as usual */
+    if (m_searching && searchKeypress(ev)) {
+        return false;
+    }
+
+    /* any other key ends history navigation */
+    if (ev.key != XK_Up && ev.key != XK_KP_Up && ev.key != XK_Down && ev.key != XK_KP_Down &&
+        !isModifier(ev.key))
+    {
+        m_navigating = false;
     }
 
     /* check for an Alt-key meaning bookmark lookup */
-    if (ev.state & Mod1Mask) {
-        string book = m_book.lookup(ev.key);
+    if ((ev.state & Mod1Mask) && ev.ch > 0x20 && ev.ch <= 0xff) {
+        string book = m_book.lookup(ev.ch);
         if (!book.empty()) {
             m_command = move(book);
             m_hist.save(m_command);
+            m_frecency.add(m_command);
             execcmd();
             return true;
         }
@@ -315,72 +928,130 @@ Thingylaunch::keypress(X11Event& ev)
 
     switch(ev.key) {
         case XK_Escape:
-            exit(0);
-            break;
+            if (m_listSelected != string::npos) {
+                m_listSelected = string::npos;
+                break;
+            }
+            return true;
 
         case XK_BackSpace:
-            m_comp.reset();
-            if (m_cursorPos != 0)
-                m_command.erase(--m_cursorPos, 1);
+            resetCompletion();
+            if (m_cursorPos != 0) {
+                auto start = prevChar(m_command, m_cursorPos);
+                m_command.erase(start, m_cursorPos - start);
+                m_cursorPos = start;
+            }
             break;
 
         case XK_Left:
         case XK_KP_Left:
+            resetCompletion();
             if (m_cursorPos != 0)
-                --m_cursorPos;
+                m_cursorPos = prevChar(m_command, m_cursorPos);
             break;
 
         case XK_Right:
         case XK_KP_Right:
+            resetCompletion();
             if (m_cursorPos < m_command.length())
-                ++m_cursorPos;
+                m_cursorPos = nextChar(m_command, m_cursorPos);
             break;
 
         case XK_Up:
         case XK_KP_Up:
-            m_command = m_hist.prev();
-            m_cursorPos = m_command.length();
+            resetCompletion();
+            if (m_listSelected != string::npos) {
+                moveSelection(-1);
+            } else {
+                navigateHistory(true);
+            }
             break;
 
         case XK_Down:
         case XK_KP_Down:
-            m_command = m_hist.next();
-            m_cursorPos = m_command.length();
+            resetCompletion();
+            if (m_listTotal > 0 && !m_navigating) {
+                moveSelection(1);
+            } else {
+                navigateHistory(false);
+            }
+            break;
+
+        case XK_Page_Up:
+        case XK_KP_Page_Up:
+            if (m_listSelected != string::npos) {
+                moveSelection(-long(m_listRows));
+            }
+            break;
+
+        case XK_Page_Down:
+        case XK_KP_Page_Down:
+            if (m_listTotal > 0) {
+                moveSelection(m_listRows);
+            }
             break;
 
         case XK_Home:
         case XK_KP_Home:
+            resetCompletion();
             m_cursorPos = 0;
             break;
 
         case XK_End:
         case XK_KP_End:
+            resetCompletion();
             m_cursorPos = m_command.length();
             break;
 
         case XK_Return:
+            acceptSelection();
             m_hist.save(m_command);
+            m_frecency.add(m_command);
             execcmd();
             return true;
             break;
 
         case XK_Tab:
         case XK_KP_Tab:
-            m_command = m_comp.next(m_command);
-            m_cursorPos = m_command.length();
+        case XK_ISO_Left_Tab:
+            m_reverseTab = (ev.state & ShiftMask) || ev.key == XK_ISO_Left_Tab;
+            if (acceptSelection()) {
+                resetCompletion();
+            } else if (completionReady(TabWait)) {
+                complete();
+            } else {
+                m_pendingTab = true;
+            }
             break;
 
         case XK_k:
+        case XK_K:
             if (ev.state & ControlMask) {
-                m_comp.reset();
+                resetCompletion();
                 m_command.clear();
                 m_cursorPos = 0;
-                ev.key = 0; // don't handle the 'k' below
+                ev.ch = 0; // don't handle the 'k' below
+            }
+            break;
+
+        case XK_r:
+        case XK_R:
+            if (ev.state & ControlMask) {
+                resetCompletion();
+                m_searching = true;
+                m_searchFailed = false;
+                m_searchQuery.clear();
+                m_searchSaved = m_command;
+                m_searchSavedPos = m_cursorPos;
+                m_hist.resetSearch();
+                ev.ch = 0; // don't handle the 'r' below
             }
             break;
 
         case XK_w:
+        case XK_W:
             if (ev.state & ControlMask) {
+                resetCompletion();
                 auto i = m_cursorPos - 1;
                 while (i > 0) {
                     if (m_command[--i] == ' ') {
@@ -395,7 +1066,7 @@ Thingylaunch::keypress(X11Event& ev)
                 m_command.erase(i, m_cursorPos);
 
                 m_cursorPos = i;
-                ev.key = 0; // don't handle the 'w' below
+                ev.ch = 0; // don't handle the 'w' below
             }
             break;
 
@@ -403,27 +1074,308 @@ Thingylaunch::keypress(X11Event& ev)
             break;
     }
 
-    /* normal printable chars including Latin-[1-8] + Keybad numbers */
-    if ((ev.key >= 0x20 && ev.key <= 0x13be) || (ev.key >= 0xffb0 && ev.key <= 0xffb9)) {
+    /* printable chars, the command line holds UTF-8 */
+    if (isPrintable(ev.ch)) {
+        string ch { encodeChar(ev.ch) };
         if (m_cursorPos == m_command.length()) {
-            m_command.push_back(ev.key);
+            m_command.append(ch);
         } else {
-            m_command.insert(m_cursorPos, 1, ev.key);
+            m_command.insert(m_cursorPos, ch);
         }
-        ++m_cursorPos;
-        m_comp.reset();
+        m_cursorPos += ch.size();
+        resetCompletion();
     }
 
     return false;
 }
 
+bool
+Thingylaunch::isModifier(uint32_t key)
+{
+    return (key >= XK_Shift_L && key <= XK_Hyper_R) || key == XK_ISO_Level3_Shift || key == XK_Mode_switch;
+}
+
+/*
+ * Whether ch is a character rather than a control code: anything from the
+ * space on, but DEL, the C1 controls and the UTF-16 surrogates.
+ */
+bool
+Thingylaunch::isPrintable(uint32_t ch)
+{
+    return ch >= 0x20 && (ch < 0x7f || ch >= 0xa0) && (ch < 0xd800 || ch >= 0xe000) && ch <= 0x10ffff;
+}
+
+string
+Thingylaunch::encodeChar(uint32_t ch)
+{
+    if (ch < 0x80) {
+        return string(1, ch);
+    }
+    if (ch < 0x800) {
+        return { char(0xc0 | ch >> 6), char(0x80 | (ch & 0x3f)) };
+    }
+    if (ch < 0x10000) {
+        return { char(0xe0 | ch >> 12), char(0x80 | (ch >> 6 & 0x3f)), char(0x80 | (ch & 0x3f)) };
+    }
+    return { char(0xf0 | ch >> 18), char(0x80 | (ch >> 12 & 0x3f)), char(0x80 | (ch >> 6 & 0x3f)),
+             char(0x80 | (ch & 0x3f)) };
+}
+
+/*
+ * The start of the character before, or after, byte pos of s, which mustn't
+ * be at that end: the UTF-8 continuation bytes go with the byte they follow.
+ */
+size_t
+Thingylaunch::prevChar(const string& s, size_t pos)
+{
+    do {
+        --pos;
+    } while (pos > 0 && (s[pos] & 0xc0) == 0x80);
+    return pos;
+}
+
+size_t
+Thingylaunch::nextChar(const string& s, size_t pos)
+{
+    do {
+        ++pos;
+    } while (pos < s.size() && (s[pos] & 0xc0) == 0x80);
+    return pos;
+}
+
+/*
+ * Step through the history entries starting with the text left of the
+ * cursor, as it was when navigation started. Stepping past either end
+ * gets back to the command line as it was typed.
+ */
 void
-Thingylaunch::execcmd()
+Thingylaunch::navigateHistory(bool older)
 {
-    if (fork()) {
+    if (!m_navigating) {
+        m_navigating = true;
+        m_navSaved = m_command;
+        m_navSavedPos = m_cursorPos;
+        m_hist.setPrefix(string_view(m_command).substr(0, m_cursorPos));
+    }
+
+    auto entry { older ? m_hist.prev() : m_hist.next() };
+    if (!entry) {
+        m_command = m_navSaved;
+        m_cursorPos = m_navSavedPos;
         return;
     }
 
+    m_command = string(*entry);
+    m_cursorPos = m_navSavedPos == 0 ? m_command.length() : m_navSavedPos;
+}
+
+/*
+ * Handle a key while searching the history, return whether it was consumed.
+ */
+bool
+Thingylaunch::searchKeypress(X11Event& ev)
+{
+    bool ctrl { (ev.state & ControlMask) != 0 };
+
+    /* modifiers on their own */
+    if (isModifier(ev.key)) {
+        return true;
+    }
+
+    if (ctrl && (ev.key == XK_r || ev.key == XK_R)) {
+        search(true);
+        return true;
+    }
+
+    if (ev.key == XK_Escape || (ctrl && (ev.key == XK_g || ev.key == XK_G))) {
+        m_searching = false;
+        m_command = m_searchSaved;
+        m_cursorPos = m_searchSavedPos;
+        return true;
+    }
+
+    if (ev.key == XK_BackSpace) {
+        if (!m_searchQuery.empty()) {
+            m_searchQuery.erase(prevChar(m_searchQuery, m_searchQuery.size()));
+        }
+        m_hist.resetSearch();
+        search(false);
+        return true;
+    }
+
+    if (!ctrl && isPrintable(ev.ch)) {
+        m_searchQuery.append(encodeChar(ev.ch));
+        /* a longer query can't match where a shorter one didn't */
+        if (!m_searchFailed) {
+            search(false);
+        }
+        return true;
+    }
+
+    /* keep the match as the command line */
+    m_searching = false;
+    return false;
+}
+
+/*
+ * Look for the newest history entry matching the search query, from the
+ * current match or the one before it.
+ */
+void
+Thingylaunch::search(bool older)
+{
+    if (m_searchQuery.empty()) {
+        m_searchFailed = false;
+        m_command = m_searchSaved;
+        m_cursorPos = m_searchSavedPos;
+        return;
+    }
+
+    auto match { m_hist.search(m_searchQuery, older) };
+    m_searchFailed = !match;
+    if (match) {
+        m_command = string(*match);
+        m_cursorPos = m_command.find(m_searchQuery);
+    }
+}
+
+/*
+ * Whether the word at the cursor can be completed right away: the first
+ * word is completed against $PATH, the others against the file system.
+ */
+bool
+Thingylaunch::completionReady(chrono::milliseconds timeout)
+{
+    auto start = FileCompletion::wordStart(m_command, m_cursorPos);
+    if (start == 0) {
+        return m_comp.wait(timeout);
+    }
+    return m_files.wait(m_command.substr(start, m_cursorPos - start), timeout);
+}
+
+void
+Thingylaunch::complete()
+{
+    m_pendingTab = false;
+
+    auto start = FileCompletion::wordStart(m_command, m_cursorPos);
+    string word { m_command.substr(start, m_cursorPos - start) };
+    string completed;
+    if (start == 0) {
+        completed = m_reverseTab ? m_comp.prev(word) : m_comp.next(word);
+    } else {
+        completed = m_reverseTab ? m_files.prev(word) : m_files.next(word);
+    }
+
+    m_command.replace(start, word.size(), completed);
+    m_cursorPos = start + completed.size();
+}
+
+void
+Thingylaunch::resetCompletion()
+{
+    m_comp.reset();
+    m_files.reset();
+    m_pendingTab = false;
+}
+
+/*
+ * Give the window the rows of the list to show: the commands matching the
+ * text left of the cursor, if that's in the first word, once the index is
+ * ready. Only the rows shown are fetched.
+ */
+void
+Thingylaunch::updateList()
+{
+    if (m_listRows == 0) {
+        return;
+    }
+
+    string word;
+    if (!m_searching && FileCompletion::wordStart(m_command, m_cursorPos) == 0 &&
+        m_comp.wait(chrono::milliseconds(0)))
+    {
+        word = m_command.substr(0, m_cursorPos);
+    }
+    if (word != m_listWord) {
+        m_listWord = word;
+        m_listTop = 0;
+        m_listSelected = string::npos;
+    }
+
+    vector<string> rows;
+    m_listTotal = word.empty() ? 0 : m_comp.list(word, m_listTop, m_listRows, rows);
+    m_x11->setList(rows, m_listTop, m_listSelected);
+}
+
+/*
+ * Move the selection in the list, scrolling it into view. Moving up past
+ * the first match leaves the list.
+ */
+void
+Thingylaunch::moveSelection(long delta)
+{
+    long selected { m_listSelected == string::npos ? -1 : long(m_listSelected) };
+    long next { min(selected + delta, long(m_listTotal) - 1) };
+    if (next < 0) {
+        next = selected > 0 && delta < -1 ? 0 : -1;
+    }
+
+    if (next < 0) {
+        m_listSelected = string::npos;
+        m_listTop = 0;
+        return;
+    }
+
+    m_listSelected = next;
+    if (m_listSelected < m_listTop) {
+        m_listTop = m_listSelected;
+    } else if (m_listSelected >= m_listTop + m_listRows) {
+        m_listTop = m_listSelected - m_listRows + 1;
+    }
+}
+
+/*
+ * Replace the word left of the cursor with the selected match, if the
+ * list still shows the matches of that word. Return whether it did.
+ */
+bool
+Thingylaunch::acceptSelection()
+{
+    if (m_listSelected == string::npos || m_command.compare(0, m_cursorPos, m_listWord) != 0 ||
+        m_cursorPos != m_listWord.size())
+    {
+        return false;
+    }
+
+    vector<string> rows;
+    m_comp.list(m_listWord, m_listSelected, 1, rows);
+    m_listSelected = string::npos;
+    if (rows.empty()) {
+        return false;
+    }
+
+    m_command.replace(0, m_cursorPos, rows[0]);
+    m_cursorPos = rows[0].size();
+    return true;
+}
+
+string
+Thingylaunch::status()
+{
+    if (m_searching) {
+        return (m_searchFailed ? "failing search: " : "search: ") + m_searchQuery;
+    }
+    if (m_pendingTab) {
+        return FileCompletion::wordStart(m_command, m_cursorPos) == 0 ? "indexing..." : "listing...";
+    }
+    return string();
+}
+
+void
+Thingylaunch::execcmd()
+{
+    /* only async-signal-safe calls after fork, there are other threads */
     string shell;
     try {
         shell = Util::getEnv("SHELL");
@@ -431,14 +1383,20 @@ Thingylaunch::execcmd()
         shell = "/bin/sh";
     }
 
+    string name { shell.substr(shell.rfind('/') + 1) };
     const char * argv[4] { 0 };
-    argv[0] = basename(const_cast<char *>(shell.c_str()));
+    argv[0] = name.c_str();
     argv[1] = "-c";
     argv[2] = m_command.c_str();
     argv[3] = NULL;
 
+    if (fork()) {
+        return;
+    }
+
+    signal(SIGCHLD, SIG_DFL);
     execv(shell.c_str(), const_cast<char * const *>(argv));
-    /* not reached */
+    _exit(127);
 }
 
 void
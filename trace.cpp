@@ -0,0 +1,223 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include "trace.h"
+
+#ifdef THINGYLAUNCH_TRACE
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace {
+
+struct Event {
+    const char * name;
+    unsigned     thread;
+    unsigned     depth;
+    long         parent;
+    long long    start; /* ns */
+    long long    end;   /* ns, 0 while running */
+    unsigned     syscalls;
+    unsigned     roundTrips;
+};
+
+bool              enabled { false };
+Trace::Format     format;
+string            fileName;
+mutex             eventsLock;
+vector<Event>     events;
+map<thread::id, unsigned> threads;
+long long         origin;
+bool              finished { false };
+
+/* the innermost open phase of this thread */
+thread_local long current { -1 };
+
+long long
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+unsigned
+threadNumber()
+{
+    auto i = threads.emplace(this_thread::get_id(), threads.size());
+    return i.first->second;
+}
+
+}
+
+void
+Trace::enable(Format f, const string& name)
+{
+    lock_guard<mutex> guard { eventsLock };
+    enabled = true;
+    format = f;
+    fileName = name;
+    origin = now();
+    threadNumber();
+}
+
+Trace::Phase::Phase(const char * name)
+    : m_index { begin(name) }
+{ }
+
+Trace::Phase::~Phase()
+{
+    end(m_index);
+}
+
+long
+Trace::begin(const char * name)
+{
+    if (!enabled) {
+        return -1;
+    }
+
+    long long start { now() };
+    lock_guard<mutex> guard { eventsLock };
+    if (finished) {
+        return -1;
+    }
+    unsigned depth { current == -1 ? 0 : events[current].depth + 1 };
+    events.push_back({ name, threadNumber(), depth, current, start - origin, 0, 0, 0 });
+    return current = events.size() - 1;
+}
+
+void
+Trace::end(long index)
+{
+    if (index == -1) {
+        return;
+    }
+
+    long long end { now() };
+    lock_guard<mutex> guard { eventsLock };
+    events[index].end = end - origin;
+    current = events[index].parent;
+}
+
+void
+Trace::syscalls(unsigned count)
+{
+    if (!enabled || current == -1) {
+        return;
+    }
+    lock_guard<mutex> guard { eventsLock };
+    events[current].syscalls += count;
+}
+
+void
+Trace::roundTrips(unsigned count)
+{
+    if (!enabled || current == -1) {
+        return;
+    }
+    lock_guard<mutex> guard { eventsLock };
+    events[current].roundTrips += count;
+}
+
+/*
+ * Startup is over: write the trace. Phases still running in other threads
+ * are reported up to now.
+ */
+void
+Trace::finish()
+{
+    if (!enabled) {
+        return;
+    }
+
+    lock_guard<mutex> guard { eventsLock };
+    if (finished) {
+        return;
+    }
+    finished = true;
+
+    if (format == Format_Chrome) {
+        if (!writeChrome()) {
+            cerr << "Error: Couldn't write the trace to " << fileName << endl;
+        }
+    } else {
+        writeSummary();
+    }
+}
+
+void
+Trace::writeSummary()
+{
+    long long end { now() - origin };
+
+    cerr << "startup trace (ms since start, syscalls, X round trips):" << endl;
+    cerr << fixed << setprecision(3);
+    for (const auto& e : events) {
+        long long stop { e.end ? e.end : end };
+        cerr << "  [" << e.thread << "] " << string(2 * e.depth, ' ') << left << setw(24 - 2 * e.depth) << e.name
+             << right << setw(10) << e.start / 1e6 << " +" << setw(9) << (stop - e.start) / 1e6
+             << setw(6) << e.syscalls << setw(6) << e.roundTrips
+             << (e.end ? "" : "  (running)") << endl;
+    }
+    cerr << "  total " << end / 1e6 << "ms" << endl;
+}
+
+bool
+Trace::writeChrome()
+{
+    long long end { now() - origin };
+    ofstream out { fileName };
+    if (!out) {
+        return false;
+    }
+
+    out << "{\"traceEvents\":[" << fixed << setprecision(3);
+    for (size_t i = 0; i < events.size(); ++i) {
+        const auto& e = events[i];
+        long long stop { e.end ? e.end : end };
+        out << (i ? "," : "") << "\n{\"name\":\"" << e.name << "\",\"ph\":\"X\""
+            << ",\"ts\":" << e.start / 1e3 << ",\"dur\":" << (stop - e.start) / 1e3
+            << ",\"pid\":" << getpid() << ",\"tid\":" << e.thread
+            << ",\"args\":{\"syscalls\":" << e.syscalls << ",\"roundtrips\":" << e.roundTrips
+            << ",\"running\":" << (e.end ? "false" : "true") << "}}";
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    return bool(out);
+}
+
+#endif /* THINGYLAUNCH_TRACE */
@@ -0,0 +1,96 @@
+/*-
+ * Copyright (C) Pietro Cerutti <gahr@gahr.ch>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Startup tracing, built with make TRACE=1. Phases are timed with
+ * CLOCK_MONOTONIC and charged with the syscalls and X round trips made
+ * while they're the innermost open phase of their thread. Without
+ * THINGYLAUNCH_TRACE, all of the macros below compile to nothing.
+ */
+
+#ifdef THINGYLAUNCH_TRACE
+
+#include <string>
+
+class Trace {
+    public:
+        enum Format {
+            Format_Summary,
+            Format_Chrome
+        };
+
+        static void enable(Format format, const std::string& fileName);
+        static void syscalls(unsigned count);
+        static void roundTrips(unsigned count);
+        static void finish();
+
+        /* a phase that doesn't follow a scope, from begin() to end() */
+        static long begin(const char * name);
+        static void end(long index);
+
+        /* a phase, from construction to destruction */
+        class Phase {
+            public:
+                explicit Phase(const char * name);
+                ~Phase();
+
+            private:
+                Phase(const Phase&) = delete;
+                Phase& operator=(const Phase&) = delete;
+
+            private:
+                long m_index;
+        };
+
+    private:
+        static void writeSummary();
+        static bool writeChrome();
+};
+
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_PHASE(name) Trace::Phase TRACE_CONCAT(tracePhase, __LINE__) { name }
+#define TRACE_SYSCALLS(count) Trace::syscalls(count)
+#define TRACE_ROUNDTRIP() Trace::roundTrips(1)
+#define TRACE_FINISH() Trace::finish()
+#define TRACE_BEGIN(name) Trace::begin(name)
+#define TRACE_END(index) Trace::end(index)
+
+#else /* !THINGYLAUNCH_TRACE */
+
+#define TRACE_PHASE(name) do { } while (0)
+#define TRACE_SYSCALLS(count) do { } while (0)
+#define TRACE_ROUNDTRIP() do { } while (0)
+#define TRACE_FINISH() do { } while (0)
+#define TRACE_BEGIN(name) (-1L)
+#define TRACE_END(index) do { } while (0)
+
+#endif /* THINGYLAUNCH_TRACE */
+
+#endif /* !TRACE_H */
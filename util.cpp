@@ -23,6 +23,9 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #include <cstdlib> // getenv
 #include <stdexcept>
 using namespace std;
@@ -38,3 +41,18 @@ Util::getEnv(string varName)
     }
     return var;
 }
+
+string
+Util::getCacheDir()
+{
+    string dir;
+    try {
+        dir = getEnv("XDG_CACHE_HOME");
+    } catch (exception&) {
+        dir = getEnv("HOME") + "/.cache";
+    }
+    mkdir(dir.c_str(), 0700);
+    dir += "/thingylaunch";
+    mkdir(dir.c_str(), 0700);
+    return dir;
+}
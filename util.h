@@ -31,6 +31,7 @@
 class Util {
     public:
         static std::string getEnv(std::string fileName);
+        static std::string getCacheDir();
 };
 
 #endif /* !UTIL_H */
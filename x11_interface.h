@@ -26,25 +26,66 @@
 #ifndef X11INTERFACE_H
 #define X11INTERFACE_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 typedef struct {
     enum EventType {
         Evt_Expose,
         Evt_KeyPress,
+        Evt_Hotkey,
+        Evt_Wakeup,
         Evt_Other
     } type;
-    uint16_t key;
+    uint32_t key;   /* the keysym, under the modifiers of state */
+    uint32_t ch;    /* the Unicode character it types, 0 if none */
     int state;
 } X11Event;
 
 struct X11Interface {
+    enum GrabStatus {
+        Grab_Pending,
+        Grab_Success,
+        Grab_Failed
+    };
+
     virtual ~X11Interface() { }
-    virtual bool createWindow(int x, int y, int width, int height) =0;
-    virtual bool setupGC(const std::string& bgColor, const std::string& fgColor, const std::string& fontDesc) =0;
-    virtual bool grabKeyboard() =0;
-    virtual bool redraw(const std::string& command, std::string::size_type cursorPos) =0;
-    virtual bool nextEvent(X11Event& ev) =0;
+    /* the window is created unmapped, show() maps it; it grows by up to
+     * listRows rows for the dropdown list */
+    virtual bool createWindow(int x, int y, int width, int height, int listRows) =0;
+    /* also reports whether creating the window failed; text is drawn
+     * anti-aliased with renderFont, a fontconfig pattern, if it's set and
+     * the server supports it, with the fontDesc core font otherwise */
+    virtual bool setupGC(const std::string& bgColor, const std::string& fgColor, const std::string& fontDesc,
+            const std::string& renderFont) =0;
+    virtual bool antialiased() =0;
+    virtual void show() =0;
+    virtual void hide() =0;
+    /* ask for the keyboard, sending show()'s requests along; grabStatus()
+     * tells the answer once it's in */
+    virtual void requestGrab() =0;
+    virtual GrabStatus grabStatus() =0;
+    /* a key combination reported as Evt_Hotkey, wherever the focus is */
+    virtual bool grabHotkey(uint16_t keysym, uint16_t modifiers) =0;
+    /* draw what changed since the last redraw, Expose events are handled
+     * on their own */
+    virtual bool redraw(const std::string& command, std::string::size_type cursorPos, const std::string& status) =0;
+    /* the dropdown list the next redraw() draws: rows of the matches
+     * from top on, the selected one highlighted; the rows still shown are
+     * moved rather than drawn again */
+    virtual void setList(const std::vector<std::string>& rows, std::size_t top, std::size_t selected) =0;
+    /* the size of the requests the last redraw() sent */
+    virtual std::size_t frameBytes() =0;
+    /* the connection's file descriptor, to poll() on before pollEvent() */
+    virtual int fd() =0;
+    /* the next event, if any, without blocking; unless read is set, only
+     * the events already read from the connection are returned */
+    virtual bool pollEvent(X11Event& ev, bool read) =0;
+    virtual bool connected() =0;
+    /* make pollEvent() return an Evt_Wakeup event, callable from any thread */
+    virtual void wakeup() =0;
 
     static X11Interface * create();
 };
@@ -24,14 +24,29 @@
  */
 
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/xcb_icccm.h>
-#include <xcb/xcb_keysyms.h>
 #include <xcb/xproto.h>
+#ifdef THINGYLAUNCH_RENDER
+#include <xcb/render.h>
+#endif
 
+#include <algorithm>
 #include <cstdlib>
-#include <ctime>
+#include <cstring>
+#include <vector>
+#ifdef THINGYLAUNCH_RENDER
+#include <unordered_set>
+#endif
 using namespace std;
 
+#include "color_name.h"
+#include "font_cache.h"
+#ifdef THINGYLAUNCH_RENDER
+#include "glyph_cache.h"
+#endif
+#include "keymap.h"
+#include "trace.h"
 #include "x11_interface.h"
 
 class X11XCB : public X11Interface {
@@ -39,27 +54,137 @@ class X11XCB : public X11Interface {
     public:
         X11XCB();
         virtual ~X11XCB();
-        virtual bool createWindow(int x, int y, int width, int height);
-        virtual bool setupGC(const string& bgColor, const string& fgColor, const string& fontDesc);
-        virtual bool grabKeyboard();
-        virtual bool redraw(const string& command, string::size_type cursorPos);
-        virtual bool nextEvent(X11Event &ev);
+        virtual bool createWindow(int x, int y, int width, int height, int listRows);
+        virtual bool setupGC(const string& bgColor, const string& fgColor, const string& fontDesc,
+                const string& renderFont);
+        virtual bool antialiased();
+        virtual void show();
+        virtual void hide();
+        virtual void requestGrab();
+        virtual GrabStatus grabStatus();
+        virtual bool grabHotkey(uint16_t keysym, uint16_t modifiers);
+        virtual bool redraw(const string& command, string::size_type cursorPos, const string& status);
+        virtual void setList(const vector<string>& rows, size_t top, size_t selected);
+        virtual size_t frameBytes();
+        virtual int fd();
+        virtual bool pollEvent(X11Event &ev, bool read);
+        virtual bool connected();
+        virtual void wakeup();
 
     private:
-        uint32_t parseColorName(const string& colorName);
-        xcb_query_text_extents_reply_t * getTextExtent(const string& s, int len);
+        bool localColor(const string& colorName, uint32_t& pixel, ColorName::RGB& rgb);
+        static uint32_t channelBits(uint16_t value, uint32_t mask);
+        xcb_alloc_named_color_cookie_t requestColor(const string& colorName);
+        bool colorReply(xcb_alloc_named_color_cookie_t cookie, uint32_t& pixel, ColorName::RGB& rgb);
+        bool checkRequest(xcb_void_cookie_t cookie);
+        void requestKeymap();
+        bool readKeymap();
+        void refreshKeymap();
+        vector<xcb_void_cookie_t> grabKeys(bool checked);
+        bool isHotkey(const xcb_key_press_event_t * ev) const;
+        uint64_t fontPathHash(xcb_get_font_path_cookie_t cookie);
+        bool resolveFont(const string& pattern, uint64_t pathHash, const FontCache& cache);
+        void readMetrics(const xcb_query_font_reply_t * reply);
+        size_t layoutText(const string& s);
+        void damageSpan(vector<xcb_rectangle_t>& damage, int x0, int x1) const;
+        static size_t decodeChar(const string& s, size_t i, uint32_t& codepoint);
+        int charWidth(const string& s, size_t i, size_t& len);
+        int textWidth(const string& s);
+        void drawText(xcb_pixmap_t buffer, bool inverse, const string& s, size_t begin, int16_t x, int16_t y);
+        void setSizeHints();
+        void createList();
+        void drawList();
+        void drawRow(size_t slot, const string& text, bool selected);
+#ifdef THINGYLAUNCH_RENDER
+        bool setupRender(xcb_render_query_pict_formats_cookie_t cookie, const ColorName::RGB& fg);
+        void uploadGlyphs(const vector<uint32_t>& ids);
+#endif
 
     private:
         xcb_connection_t  * m_connection;
         xcb_screen_t      * m_screen;
+        xcb_visualtype_t  * m_visual;
         xcb_window_t        m_win;
-        xcb_key_symbols_t * m_keysyms;
+        xcb_void_cookie_t   m_createCookie;
+
+        /* what the keys mean, asked for along with the window, and again
+         * once the mapping changed */
+        Keymap              m_keymap;
+        bool                m_keymapStale;
+        xcb_get_keyboard_mapping_cookie_t m_keyboardCookie;
+        xcb_get_modifier_mapping_cookie_t m_modifierCookie;
+
+        /* the hotkey, grabbed on the keycodes giving its keysym */
+        uint32_t            m_hotkeySym;
+        uint16_t            m_hotkeyMods;
+        vector<uint8_t>     m_hotkeyCodes;
+
         xcb_font_t          m_font;
+        FontCache::Font     m_fontInfo;
         xcb_gcontext_t      m_fgGc;
         xcb_gcontext_t      m_bgGc;
+        uint32_t            m_fgPixel;
+        uint32_t            m_bgPixel;
+        ColorName::RGB      m_bgRgb;
+
+        /* anti-aliased text: the glyphs are uploaded to m_glyphset once,
+         * under their code point, and composited from m_fgPicture */
+        bool                m_render;
+#ifdef THINGYLAUNCH_RENDER
+        GlyphCache              m_glyphCache;
+        unordered_set<uint32_t> m_uploaded;
+        xcb_render_pictformat_t m_visualFormat;
+        xcb_render_picture_t    m_picture;
+        xcb_render_picture_t    m_fgPicture;
+        xcb_render_glyphset_t   m_glyphset;
+
+        /* created along with the list */
+        xcb_render_picture_t    m_listPicture;
+        xcb_render_picture_t    m_bgPicture;
+        static constexpr size_t MaxGlyphsPerElt { 254 };
+#endif
 
+        /* the frame is drawn into m_buffer, then only what changed since
+         * the last frame is copied to the window */
+        xcb_pixmap_t        m_buffer;
+        bool                m_painted;
+        int16_t             m_cursorX;
+        int16_t             m_statusX;
+        string              m_status;
+        size_t              m_frameBytes;
+
+        /* the last text laid out, and the x offset of each of its
+         * characters and of its end */
+        string              m_text;
+        vector<int>         m_textOffsets;
+
+        /* the dropdown list, drawn into m_listBuffer below the command
+         * line once needed: the rows setList() asked for, and the rows
+         * drawn, the match at m_drawnTop first */
+        struct Row {
+            string text;
+            bool selected { false };
+            bool valid { false };
+        };
+        uint16_t            m_listRows;
+        uint16_t            m_rowHeight;
+        xcb_pixmap_t        m_listBuffer;
+        xcb_gcontext_t      m_selGc;
+        vector<string>      m_rows;
+        size_t              m_rowsTop;
+        size_t              m_rowsSelected;
+        vector<Row>         m_drawnRows;
+        size_t              m_drawnTop;
+
+        /* the keyboard grab waiting for its reply */
+        bool                        m_grabPending;
+        xcb_grab_keyboard_cookie_t  m_grabCookie;
+
+        int16_t  m_x;
+        int16_t  m_y;
         uint16_t m_width;
         uint16_t m_height;
+        uint16_t m_windowHeight; /* with the list */
 };
 
 X11Interface *
@@ -69,7 +194,24 @@ X11Interface::create()
 }
 
 X11XCB::X11XCB()
-    : m_connection(nullptr)
+    : m_connection(nullptr),
+      m_visual(nullptr),
+      m_keymapStale(false),
+      m_hotkeySym(0),
+      m_hotkeyMods(0),
+      m_font(XCB_NONE),
+      m_render(false),
+      m_painted(false),
+      m_cursorX(0),
+      m_statusX(0),
+      m_frameBytes(0),
+      m_listRows(0),
+      m_rowHeight(0),
+      m_listBuffer(XCB_NONE),
+      m_rowsTop(0),
+      m_rowsSelected(0),
+      m_drawnTop(0),
+      m_grabPending(false)
 { }
 
 X11XCB::~X11XCB()
@@ -77,32 +219,68 @@ X11XCB::~X11XCB()
     if (!m_connection)
         return;
 
-    free(m_keysyms);
+#ifdef THINGYLAUNCH_RENDER
+    if (m_render) {
+        m_glyphCache.save();
+        xcb_render_free_picture(m_connection, m_picture);
+        xcb_render_free_picture(m_connection, m_fgPicture);
+        xcb_render_free_glyph_set(m_connection, m_glyphset);
+        if (m_listBuffer != XCB_NONE) {
+            xcb_render_free_picture(m_connection, m_listPicture);
+            xcb_render_free_picture(m_connection, m_bgPicture);
+        }
+    } else
+#endif
     xcb_close_font(m_connection, m_font);
+    if (m_listBuffer != XCB_NONE) {
+        xcb_free_gc(m_connection, m_selGc);
+        xcb_free_pixmap(m_connection, m_listBuffer);
+    }
     xcb_free_gc(m_connection, m_fgGc);
     xcb_free_gc(m_connection, m_bgGc);
+    xcb_free_pixmap(m_connection, m_buffer);
     xcb_destroy_window(m_connection, m_win);
     xcb_disconnect(m_connection);
 }
 
 bool
-X11XCB::createWindow(int x, int y, int width, int height)
+X11XCB::createWindow(int x, int y, int width, int height, int listRows)
 {
     m_width = width;
     m_height = height;
+    m_windowHeight = height;
+    m_listRows = listRows;
 
     /* open connection to the display server */
-    if ((m_connection = xcb_connect(NULL, NULL)) == nullptr) {
-        return false;
-    }
-    m_screen = xcb_setup_roots_iterator(xcb_get_setup(m_connection)).data;
+    {
+        TRACE_PHASE("xcb_connect");
+        m_connection = xcb_connect(NULL, NULL);
+        if (xcb_connection_has_error(m_connection)) {
+            return false;
+        }
+        m_screen = xcb_setup_roots_iterator(xcb_get_setup(m_connection)).data;
 
-    /* allocate keysyms */
-    m_keysyms = xcb_key_symbols_alloc(m_connection);
-    if (m_keysyms == nullptr) {
-        return false;
+        /* the root visual, to compute the color pixels ourselves */
+        for (auto d = xcb_screen_allowed_depths_iterator(m_screen); d.rem && !m_visual; xcb_depth_next(&d)) {
+            for (auto v = xcb_depth_visuals_iterator(d.data); v.rem; xcb_visualtype_next(&v)) {
+                if (v.data->visual_id == m_screen->root_visual) {
+                    m_visual = v.data;
+                    break;
+                }
+            }
+        }
+
+#ifdef THINGYLAUNCH_RENDER
+        /* ask for the render extension along with the window */
+        xcb_prefetch_extension_data(m_connection, &xcb_render_id);
+#endif
+
+        /* the keyboard mapping, read by setupGC() */
+        requestKeymap();
     }
 
+    TRACE_PHASE("create window");
+
     /* figure out the window location */
     if (x == -1) {
         x = m_screen->width_in_pixels / 2 - width / 2;
@@ -115,198 +293,1148 @@ X11XCB::createWindow(int x, int y, int width, int height)
     uint32_t mask { XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK };
     uint32_t value[] { 1, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_KEY_PRESS };
     m_win = xcb_generate_id(m_connection);
-    auto createCookie = xcb_create_window_checked(m_connection, XCB_COPY_FROM_PARENT, m_win, m_screen->root,
+    m_createCookie = xcb_create_window_checked(m_connection, XCB_COPY_FROM_PARENT, m_win, m_screen->root,
             x, y, width, height, 0, 0, m_screen->root_visual, mask, value);
 
     /* set wm hints */
+    m_x = x;
+    m_y = y;
+    setSizeHints();
+
+    /* don't wait for the server here, setupGC() collects the errors */
+    return true;
+}
+
+/*
+ * The window has a fixed size, which only changes with the list.
+ */
+void
+X11XCB::setSizeHints()
+{
     xcb_size_hints_t hints;
     hints.flags = XCB_ICCCM_SIZE_HINT_P_SIZE | XCB_ICCCM_SIZE_HINT_P_POSITION | XCB_ICCCM_SIZE_HINT_P_SIZE | 
                   XCB_ICCCM_SIZE_HINT_P_MIN_SIZE | XCB_ICCCM_SIZE_HINT_P_MAX_SIZE;
-    hints.x = x;
-    hints.y = y;
-    hints.min_width = hints.max_width = width;
-    hints.min_height = hints.max_height = height;
-    xcb_icccm_set_wm_normal_hints_checked(m_connection, m_win, &hints);
+    hints.x = m_x;
+    hints.y = m_y;
+    hints.min_width = hints.max_width = m_width;
+    hints.min_height = hints.max_height = m_windowHeight;
+    xcb_icccm_set_wm_normal_hints(m_connection, m_win, &hints);
+}
 
-    /* map the window */
-    auto mapCookie = xcb_map_window_checked(m_connection, m_win);
+void
+X11XCB::show()
+{
+    uint32_t stackMode { XCB_STACK_MODE_ABOVE };
+    xcb_configure_window(m_connection, m_win, XCB_CONFIG_WINDOW_STACK_MODE, &stackMode);
+    xcb_map_window(m_connection, m_win);
+    /* flushed along with the grab request */
+}
 
-    if (xcb_request_check(m_connection, createCookie)) {
-        return false;
+void
+X11XCB::hide()
+{
+    if (m_grabPending) {
+        xcb_discard_reply(m_connection, m_grabCookie.sequence);
+        m_grabPending = false;
     }
+    xcb_ungrab_keyboard(m_connection, XCB_CURRENT_TIME);
+    xcb_unmap_window(m_connection, m_win);
+    xcb_flush(m_connection);
 
-    if (xcb_request_check(m_connection, mapCookie)) {
+#ifdef THINGYLAUNCH_RENDER
+    /* keep what was rasterized while shown, the daemon might be killed */
+    if (m_render) {
+        m_glyphCache.save();
+    }
+#endif
+}
+
+/*
+ * On TrueColor visuals, the pixel is the color itself, laid out by the
+ * visual's channel masks: no need to ask the server for known colors.
+ */
+bool
+X11XCB::localColor(const string& colorName, uint32_t& pixel, ColorName::RGB& rgb)
+{
+    if (!m_visual || m_visual->_class != XCB_VISUAL_CLASS_TRUE_COLOR || !ColorName::parse(colorName, rgb)) {
         return false;
     }
 
+    pixel = channelBits(rgb.red, m_visual->red_mask) |
+            channelBits(rgb.green, m_visual->green_mask) |
+            channelBits(rgb.blue, m_visual->blue_mask);
     return true;
 }
 
+/*
+ * The most significant bits of a 16-bit channel, moved into the mask.
+ */
 uint32_t
-X11XCB::parseColorName(const string& colorName)
+X11XCB::channelBits(uint16_t value, uint32_t mask)
+{
+    if (!mask) {
+        return 0;
+    }
+    int shift { __builtin_ctz(mask) };
+    int bits { __builtin_popcount(mask) };
+    uint32_t v { bits < 16 ? uint32_t(value) >> (16 - bits) : uint32_t(value) << (bits - 16) };
+    return (v << shift) & mask;
+}
+
+/*
+ * Look up and allocate a color in a single request, the reply is
+ * collected by colorReply().
+ */
+xcb_alloc_named_color_cookie_t
+X11XCB::requestColor(const string& colorName)
+{
+    return xcb_alloc_named_color(m_connection, m_screen->default_colormap, colorName.size(), colorName.c_str());
+}
+
+bool
+X11XCB::colorReply(xcb_alloc_named_color_cookie_t cookie, uint32_t& pixel, ColorName::RGB& rgb)
+{
+    xcb_generic_error_t * err { nullptr };
+    auto reply = xcb_alloc_named_color_reply(m_connection, cookie, &err);
+    if (!reply) {
+        free(err);
+        return false;
+    }
+    pixel = reply->pixel;
+    rgb = { reply->visual_red, reply->visual_green, reply->visual_blue };
+    free(reply);
+    return true;
+}
+
+/*
+ * Whether a checked request succeeded. This only waits for the server if
+ * no reply to a later request has been received yet.
+ */
+bool
+X11XCB::checkRequest(xcb_void_cookie_t cookie)
+{
+    if (auto err = xcb_request_check(m_connection, cookie)) {
+        free(err);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Ask for the keyboard and modifier mappings, readKeymap() builds the
+ * keymap from them.
+ */
+void
+X11XCB::requestKeymap()
+{
+    const xcb_setup_t * setup { xcb_get_setup(m_connection) };
+    m_keyboardCookie = xcb_get_keyboard_mapping(m_connection, setup->min_keycode,
+            setup->max_keycode - setup->min_keycode + 1);
+    m_modifierCookie = xcb_get_modifier_mapping(m_connection);
+}
+
+bool
+X11XCB::readKeymap()
+{
+    auto keyboard = xcb_get_keyboard_mapping_reply(m_connection, m_keyboardCookie, nullptr);
+    auto modifier = xcb_get_modifier_mapping_reply(m_connection, m_modifierCookie, nullptr);
+    bool ok { keyboard && modifier && keyboard->keysyms_per_keycode };
+    if (ok) {
+        const xcb_setup_t * setup { xcb_get_setup(m_connection) };
+        m_keymap.build(setup->min_keycode, xcb_get_keyboard_mapping_keysyms_length(keyboard) / keyboard->keysyms_per_keycode,
+                keyboard->keysyms_per_keycode, xcb_get_keyboard_mapping_keysyms(keyboard),
+                modifier->keycodes_per_modifier, xcb_get_modifier_mapping_keycodes(modifier));
+    }
+    free(keyboard);
+    free(modifier);
+    m_keymapStale = false;
+    return ok;
+}
+
+/*
+ * Build the keymap again after MappingNotify events, once for all of the
+ * ones that came together, and move the hotkey grab to its new keycodes.
+ */
+void
+X11XCB::refreshKeymap()
+{
+    requestKeymap();
+    readKeymap();
+
+    if (m_hotkeySym) {
+        for (auto k : m_hotkeyCodes) {
+            xcb_ungrab_key(m_connection, k, m_screen->root, XCB_MOD_MASK_ANY);
+        }
+        grabKeys(false);
+        xcb_flush(m_connection);
+    }
+}
+
+/*
+ * Compute the x offsets of the characters of s from the glyph widths, as
+ * a prefix sum. Only the part after what s shares with the last text is
+ * computed again, so typing at the end costs a single addition. Return
+ * the index of the first character that changed.
+ */
+size_t
+X11XCB::layoutText(const string& s)
 {
-     auto lc = xcb_lookup_color(m_connection, m_screen->default_colormap, colorName.size(), colorName.c_str());
-     auto lr = xcb_lookup_color_reply(m_connection, lc, NULL);
-     auto ac = xcb_alloc_color(m_connection, m_screen->default_colormap, lr->exact_red, lr->exact_green, lr->exact_blue);
-     auto ar = xcb_alloc_color_reply(m_connection, ac, NULL);
+    auto diff = mismatch(m_text.begin(), m_text.end(), s.begin(), s.end());
+    size_t common = diff.second - s.begin();
+
+    /* the change can end or extend the UTF-8 sequence before it: start
+     * over from its first byte */
+    if (common < max(m_text.size(), s.size())) {
+        while (common > 0 && (s[common - 1] & 0xc0) == 0x80) {
+            --common;
+        }
+        if (common > 0) {
+            --common;
+        }
+    }
 
-     uint32_t color { ar->pixel };
+    m_textOffsets.resize(s.size() + 1);
+    m_textOffsets[0] = 0;
+    for (size_t i = common; i < s.size(); ) {
+        size_t len;
+        m_textOffsets[i + 1] = m_textOffsets[i] + charWidth(s, i, len);
+        for (size_t j = i + 1; j < i + len; ++j) {
+            m_textOffsets[j + 1] = m_textOffsets[j];
+        }
+        i += len;
+    }
+    m_text = s;
+    return common;
+}
 
-     free(lr);
-     free(ar);
+/*
+ * The width of the character starting at byte i of s, the UTF-8 sequence
+ * len bytes long, the first byte of which carries the width; a byte that
+ * doesn't start a valid sequence stands for its Latin-1 character. The
+ * core font has the Latin-1 characters only, it shows the others as '?'.
+ */
+int
+X11XCB::charWidth(const string& s, size_t i, size_t& len)
+{
+    uint32_t c;
+    len = decodeChar(s, i, c);
+#ifdef THINGYLAUNCH_RENDER
+    if (m_render) {
+        auto g = m_glyphCache.glyph(c);
+        return g ? g->advance : 0;
+    }
+#endif
+    return m_fontInfo.widths[c <= 0xff ? c : '?'];
+}
 
-     return color;
+int
+X11XCB::textWidth(const string& s)
+{
+    int width { 0 };
+    for (size_t i = 0; i < s.size(); ) {
+        size_t len;
+        width += charWidth(s, i, len);
+        i += len;
+    }
+    return width;
 }
 
-xcb_query_text_extents_reply_t *
-X11XCB::getTextExtent(const string& s, int len)
+/*
+ * Draw the characters of s from byte begin on into buffer, starting at x,
+ * in the background color if inverse is set. The core font draws them
+ * along with their background.
+ */
+void
+X11XCB::drawText(xcb_pixmap_t buffer, bool inverse, const string& s, size_t begin, int16_t x, int16_t y)
 {
-    xcb_char2b_t chars[len];
-    for (int i = 0; i < len; ++i) {
-        chars[i].byte1 = 0;
-        chars[i].byte2 = s[i];
+    if (begin >= s.size()) {
+        return;
     }
 
-    auto cookie = xcb_query_text_extents(m_connection, m_font, len, chars);
-    auto reply = xcb_query_text_extents_reply(m_connection, cookie, NULL);
+#ifdef THINGYLAUNCH_RENDER
+    if (m_render) {
+        vector<uint32_t> ids;
+        uint32_t maxId { 0 };
+        for (size_t i = begin; i < s.size(); ) {
+            uint32_t c;
+            i += decodeChar(s, i, c);
+            if (m_glyphCache.glyph(c)) {
+                ids.push_back(c);
+                maxId = max(maxId, c);
+            }
+        }
+        uploadGlyphs(ids);
+
+        /* the glyph ids in elements of at most 254 of them, the first
+         * element moving to where the text starts */
+        size_t idSize { maxId < 0x100 ? 1u : maxId < 0x10000 ? 2u : 4u };
+        vector<uint8_t> cmds;
+        for (size_t i = 0; i < ids.size(); i += MaxGlyphsPerElt) {
+            size_t n { min(ids.size() - i, MaxGlyphsPerElt) };
+            uint8_t elt[8] { uint8_t(n) };
+            int16_t delta[] { int16_t(i ? 0 : x), int16_t(i ? 0 : y) };
+            memcpy(elt + 4, delta, sizeof(delta));
+            cmds.insert(cmds.end(), elt, elt + sizeof(elt));
+            for (size_t j = i; j < i + n; ++j) {
+                uint8_t id8 { uint8_t(ids[j]) };
+                uint16_t id16 { uint16_t(ids[j]) };
+                const void * id { idSize == 1 ? static_cast<const void *>(&id8) :
+                                  idSize == 2 ? static_cast<const void *>(&id16) : &ids[j] };
+                cmds.insert(cmds.end(), static_cast<const uint8_t *>(id), static_cast<const uint8_t *>(id) + idSize);
+            }
+            cmds.resize((cmds.size() + 3) / 4 * 4);
+        }
+        if (cmds.empty()) {
+            return;
+        }
 
-    return reply;
+        auto composite = idSize == 1 ? xcb_render_composite_glyphs_8 :
+                         idSize == 2 ? xcb_render_composite_glyphs_16 : xcb_render_composite_glyphs_32;
+        composite(m_connection, XCB_RENDER_PICT_OP_OVER, inverse ? m_bgPicture : m_fgPicture,
+                buffer == m_buffer ? m_picture : m_listPicture, XCB_NONE, m_glyphset, 0, 0, cmds.size(), cmds.data());
+        m_frameBytes += 28 + cmds.size();
+        return;
+    }
+#endif
+
+    string latin1;
+    for (size_t i = begin; i < s.size(); ) {
+        uint32_t c;
+        i += decodeChar(s, i, c);
+        latin1.push_back(c <= 0xff ? c : '?');
+    }
+    xcb_image_text_8(m_connection, latin1.size(), buffer, inverse ? m_selGc : m_fgGc, x, y, latin1.c_str());
+    m_frameBytes += 16 + (latin1.size() + 3) / 4 * 4;
 }
 
+/*
+ * Decode the UTF-8 sequence at byte i of s, and return its length. A byte
+ * that doesn't start a valid, shortest sequence is taken as Latin-1.
+ */
+size_t
+X11XCB::decodeChar(const string& s, size_t i, uint32_t& codepoint)
+{
+    unsigned char b { static_cast<unsigned char>(s[i]) };
+    size_t len { b >= 0xf0 && b < 0xf5 ? 4u : b >= 0xe0 ? 3u : b >= 0xc2 && b < 0xe0 ? 2u : 1u };
+    if (b < 0xc2 || b >= 0xf5 || i + len > s.size()) {
+        codepoint = b;
+        return 1;
+    }
+
+    uint32_t c { b & (0x7fu >> len) };
+    for (size_t j = 1; j < len; ++j) {
+        unsigned char cont { static_cast<unsigned char>(s[i + j]) };
+        if ((cont & 0xc0) != 0x80) {
+            codepoint = b;
+            return 1;
+        }
+        c = (c << 6) | (cont & 0x3f);
+    }
+
+    /* overlong, surrogate, or past U+10FFFF */
+    static const uint32_t minimum[] { 0, 0, 0x80, 0x800, 0x10000 };
+    if (c < minimum[len] || (c >= 0xd800 && c < 0xe000) || c > 0x10ffff) {
+        codepoint = b;
+        return 1;
+    }
+    codepoint = c;
+    return len;
+}
+
+#ifdef THINGYLAUNCH_RENDER
+/*
+ * Find the picture formats of the back buffer and of the glyphs, and
+ * create the pictures and the glyph set. Nothing is checked: errors show
+ * up on the connection.
+ */
 bool
-X11XCB::setupGC(const string& bgColorName, const string& fgColorName, const string& fontDesc)
+X11XCB::setupRender(xcb_render_query_pict_formats_cookie_t cookie, const ColorName::RGB& fg)
 {
-    /* open font */
+    auto reply = xcb_render_query_pict_formats_reply(m_connection, cookie, nullptr);
+    if (!reply) {
+        return false;
+    }
+
+    xcb_render_pictformat_t alphaFormat { XCB_NONE };
+    for (auto f = xcb_render_query_pict_formats_formats_iterator(reply); f.rem; xcb_render_pictforminfo_next(&f)) {
+        const auto& d = f.data->direct;
+        if (f.data->type == XCB_RENDER_PICT_TYPE_DIRECT && f.data->depth == 8 && d.alpha_mask == 0xff &&
+            !d.red_mask && !d.green_mask && !d.blue_mask)
+        {
+            alphaFormat = f.data->id;
+            break;
+        }
+    }
+
+    xcb_render_pictformat_t visualFormat { XCB_NONE };
+    for (auto s = xcb_render_query_pict_formats_screens_iterator(reply); s.rem; xcb_render_pictscreen_next(&s)) {
+        for (auto d = xcb_render_pictscreen_depths_iterator(s.data); d.rem; xcb_render_pictdepth_next(&d)) {
+            for (auto v = xcb_render_pictdepth_visuals_iterator(d.data); v.rem; xcb_render_pictvisual_next(&v)) {
+                if (v.data->visual == m_screen->root_visual) {
+                    visualFormat = v.data->format;
+                }
+            }
+        }
+    }
+    free(reply);
+
+    if (alphaFormat == XCB_NONE || visualFormat == XCB_NONE) {
+        return false;
+    }
+
+    m_visualFormat = visualFormat;
+    m_picture = xcb_generate_id(m_connection);
+    xcb_render_create_picture(m_connection, m_picture, m_buffer, visualFormat, 0, nullptr);
+    m_fgPicture = xcb_generate_id(m_connection);
+    xcb_render_create_solid_fill(m_connection, m_fgPicture, { fg.red, fg.green, fg.blue, 0xffff });
+    m_glyphset = xcb_generate_id(m_connection);
+    xcb_render_create_glyph_set(m_connection, m_glyphset, alphaFormat);
+
+    m_fontInfo.ascent = m_glyphCache.ascent();
+    m_fontInfo.descent = m_glyphCache.descent();
+    return true;
+}
+
+/*
+ * Send the glyphs of ids the server doesn't have yet, in one request.
+ */
+void
+X11XCB::uploadGlyphs(const vector<uint32_t>& ids)
+{
+    vector<uint32_t> newIds;
+    vector<xcb_render_glyphinfo_t> infos;
+    vector<uint8_t> data;
+    for (auto id : ids) {
+        if (!m_uploaded.insert(id).second) {
+            continue;
+        }
+        auto g = m_glyphCache.glyph(id);
+        newIds.push_back(id);
+        infos.push_back({ g->width, g->height, int16_t(-g->left), g->top, g->advance, 0 });
+        data.insert(data.end(), g->alpha, g->alpha + g->stride() * g->height);
+    }
+
+    if (!newIds.empty()) {
+        xcb_render_add_glyphs(m_connection, m_glyphset, newIds.size(), newIds.data(), infos.data(),
+                data.size(), data.data());
+        m_frameBytes += 12 + newIds.size() * (4 + sizeof(xcb_render_glyphinfo_t)) + data.size();
+    }
+}
+#endif
+
+/*
+ * A hash of the server's font path, which decides what the font patterns
+ * resolve to.
+ */
+uint64_t
+X11XCB::fontPathHash(xcb_get_font_path_cookie_t cookie)
+{
+    auto reply = xcb_get_font_path_reply(m_connection, cookie, NULL);
+    if (!reply) {
+        return 0;
+    }
+
+    uint64_t h { FontCache::hash("") };
+    for (auto i = xcb_get_font_path_path_iterator(reply); i.rem; xcb_str_next(&i)) {
+        h = FontCache::hash(string_view(xcb_str_name(i.data), xcb_str_name_length(i.data)), h);
+    }
+    free(reply);
+    return h;
+}
+
+/*
+ * Let the server match the pattern against its fonts, open the font it
+ * picks, and remember its name and metrics. This is the slow path, taken
+ * when the cache has nothing for the pattern or the font path changed.
+ */
+bool
+X11XCB::resolveFont(const string& pattern, uint64_t pathHash, const FontCache& cache)
+{
+    TRACE_PHASE("resolve font");
+
+    auto listCookie = xcb_list_fonts(m_connection, 1, pattern.size(), pattern.c_str());
+    auto listReply = xcb_list_fonts_reply(m_connection, listCookie, NULL);
+    TRACE_ROUNDTRIP();
+    if (!listReply) {
+        return false;
+    }
+    auto names = xcb_list_fonts_names_iterator(listReply);
+    if (!names.rem) {
+        free(listReply);
+        return false;
+    }
+    m_fontInfo.name.assign(xcb_str_name(names.data), xcb_str_name_length(names.data));
+    free(listReply);
+
     m_font = xcb_generate_id(m_connection);
-    auto fontCookie = xcb_open_font_checked(m_connection, m_font, fontDesc.size(), fontDesc.c_str());
-    if (xcb_request_check(m_connection, fontCookie)) {
+    auto fontCookie = xcb_open_font_checked(m_connection, m_font, m_fontInfo.name.size(), m_fontInfo.name.c_str());
+    auto queryCookie = xcb_query_font(m_connection, m_font);
+    auto queryReply = xcb_query_font_reply(m_connection, queryCookie, NULL);
+    TRACE_ROUNDTRIP();
+    if (!checkRequest(fontCookie) || !queryReply) {
+        free(queryReply);
         return false;
     }
+    readMetrics(queryReply);
+    free(queryReply);
 
-    /* resolve colors */
-    auto bgColor = parseColorName(bgColorName);
-    auto fgColor = parseColorName(fgColorName);
+    cache.save(pattern, pathHash, m_fontInfo);
+    return true;
+}
+
+/*
+ * The ascent, descent, and widths of the characters 0 to 255 as drawn by
+ * ImageText8. A missing character is drawn as the default one, if any.
+ */
+void
+X11XCB::readMetrics(const xcb_query_font_reply_t * reply)
+{
+    auto infos = xcb_query_font_char_infos(reply);
+    int count { xcb_query_font_char_infos_length(reply) };
+
+    /* the width of a character in row 0, or -1 if there is no such glyph */
+    auto width = [&](unsigned c) -> int {
+        if (reply->min_byte1 != 0 || c < reply->min_char_or_byte2 || c > reply->max_char_or_byte2) {
+            return -1;
+        }
+        if (count == 0) {
+            /* all the glyphs have the same metrics */
+            return reply->max_bounds.character_width;
+        }
+        unsigned i { c - reply->min_char_or_byte2 };
+        if (i >= unsigned(count)) {
+            return -1;
+        }
+        const auto& ci = infos[i];
+        if (!ci.character_width && !ci.left_side_bearing && !ci.right_side_bearing && !ci.ascent && !ci.descent) {
+            return -1;
+        }
+        return ci.character_width;
+    };
+
+    int defaultWidth { max(width(reply->default_char), 0) };
+    for (unsigned c = 0; c < 256; ++c) {
+        int w { width(c) };
+        m_fontInfo.widths[c] = w == -1 ? defaultWidth : w;
+    }
+    m_fontInfo.ascent = reply->font_ascent;
+    m_fontInfo.descent = reply->font_descent;
+}
+
+/*
+ * Everything is sent before anything is waited for: the font the pattern
+ * resolved to last time, the gcs, and the colors the server has to
+ * resolve. The font path is asked for last, so its reply comes after the
+ * errors of all the requests before it, including the window creation,
+ * and checking them needs no sync of its own: the whole setup costs a
+ * single round trip. The font and the colors go into the
+ * gcs afterwards.
+ *
+ * Anti-aliased text, if renderFont names a fontconfig pattern, costs one
+ * more round trip for the render extension's picture formats. Without
+ * the extension, the core font is used.
+ */
+bool
+X11XCB::setupGC(const string& bgColorName, const string& fgColorName, const string& fontDesc,
+        const string& renderFont)
+{
+    TRACE_PHASE("setup gc");
+
+    /* open the font the pattern resolved to last time, also with a
+     * renderFont: it's what is drawn with if that can't be */
+    FontCache fontCache;
+    uint64_t cachedPathHash { 0 };
+    bool cached { fontCache.lookup(fontDesc, m_fontInfo, cachedPathHash) };
+    xcb_void_cookie_t fontCookie;
+    if (cached) {
+        m_font = xcb_generate_id(m_connection);
+        fontCookie = xcb_open_font_checked(m_connection, m_font, m_fontInfo.name.size(), m_fontInfo.name.c_str());
+    }
 
     /* create gc */
-    uint32_t gcMask { XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_LINE_WIDTH | XCB_GC_LINE_STYLE | XCB_GC_CAP_STYLE | XCB_GC_JOIN_STYLE | XCB_GC_FONT };
-    uint32_t gcValues[] { fgColor, bgColor, 1, XCB_LINE_STYLE_SOLID, XCB_CAP_STYLE_BUTT, XCB_JOIN_STYLE_BEVEL, m_font };
+    uint32_t gcMask { XCB_GC_LINE_WIDTH | XCB_GC_LINE_STYLE | XCB_GC_CAP_STYLE | XCB_GC_JOIN_STYLE };
+    uint32_t gcValues[] { 1, XCB_LINE_STYLE_SOLID, XCB_CAP_STYLE_BUTT, XCB_JOIN_STYLE_BEVEL };
     m_fgGc = xcb_generate_id(m_connection);
     auto fgGcCookie = xcb_create_gc_checked(m_connection, m_fgGc, m_win, gcMask, gcValues);
 
     /* create rectangle gc */
-    uint32_t rectgcMask { XCB_GC_FOREGROUND | XCB_GC_BACKGROUND };
-    uint32_t rectgcValues[] { bgColor, bgColor };
     m_bgGc = xcb_generate_id(m_connection);
-    auto bgGcCookie = xcb_create_gc_checked(m_connection, m_bgGc, m_win, rectgcMask, rectgcValues);
+    auto bgGcCookie = xcb_create_gc_checked(m_connection, m_bgGc, m_win, 0, nullptr);
 
-    if (xcb_request_check(m_connection, fgGcCookie)) {
-        return false;
+    /* create the back buffer */
+    m_buffer = xcb_generate_id(m_connection);
+    auto bufferCookie = xcb_create_pixmap_checked(m_connection, m_screen->root_depth, m_buffer, m_win, m_width, m_height);
+
+    /* resolve colors, locally if possible */
+    uint32_t bgColor, fgColor;
+    ColorName::RGB bgRgb, fgRgb;
+    bool bgLocal { localColor(bgColorName, bgColor, bgRgb) };
+    bool fgLocal { localColor(fgColorName, fgColor, fgRgb) };
+    xcb_alloc_named_color_cookie_t bgColorCookie, fgColorCookie;
+    if (!bgLocal) {
+        bgColorCookie = requestColor(bgColorName);
+    }
+    if (!fgLocal) {
+        fgColorCookie = requestColor(fgColorName);
+    }
+
+#ifdef THINGYLAUNCH_RENDER
+    /* the extension was asked for with the window; rasterize while the
+     * server answers */
+    bool render { false };
+    xcb_render_query_pict_formats_cookie_t formatsCookie;
+    if (!renderFont.empty()) {
+        xcb_flush(m_connection);
+        bool glyphsOk { m_glyphCache.open(renderFont) };
+        auto ext = xcb_get_extension_data(m_connection, &xcb_render_id);
+        TRACE_ROUNDTRIP();
+        if (glyphsOk && ext && ext->present) {
+            auto versionCookie = xcb_render_query_version(m_connection, 0, 11);
+            xcb_discard_reply(m_connection, versionCookie.sequence);
+            formatsCookie = xcb_render_query_pict_formats(m_connection);
+            render = true;
+        }
     }
-    if (xcb_request_check(m_connection, bgGcCookie)) {
+#endif
+
+    /* the last request with a reply, see above */
+    auto pathCookie = xcb_get_font_path(m_connection);
+
+    bool colorsOk { true };
+    if (!bgLocal) {
+        colorsOk = colorReply(bgColorCookie, bgColor, bgRgb) && colorsOk;
+    }
+    if (!fgLocal) {
+        colorsOk = colorReply(fgColorCookie, fgColor, fgRgb) && colorsOk;
+    }
+    uint64_t pathHash { fontPathHash(pathCookie) };
+
+    /* answered by now */
+    TRACE_ROUNDTRIP();
+    bool ok { readKeymap() };
+    ok = checkRequest(m_createCookie) && ok;
+    ok = checkRequest(fgGcCookie) && ok;
+    ok = checkRequest(bgGcCookie) && ok;
+    ok = checkRequest(bufferCookie) && ok;
+    if (!ok || !colorsOk) {
         return false;
     }
 
+#ifdef THINGYLAUNCH_RENDER
+    m_render = render && setupRender(formatsCookie, fgRgb);
+#endif
+
+    /* the font went away, or the pattern might match another one now */
+    bool fontOk { cached && checkRequest(fontCookie) };
+    if (m_render) {
+        if (fontOk) {
+            xcb_close_font(m_connection, m_font);
+        }
+        m_font = XCB_NONE;
+    } else if (!fontOk || pathHash != cachedPathHash) {
+        if (fontOk) {
+            xcb_close_font(m_connection, m_font);
+        }
+        if (!resolveFont(fontDesc, pathHash, fontCache)) {
+            return false;
+        }
+    }
+
+    m_fgPixel = fgColor;
+    m_bgPixel = bgColor;
+    m_bgRgb = bgRgb;
+
+    uint32_t fgMask { XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | (m_render ? 0u : XCB_GC_FONT) };
+    uint32_t fgValues[] { fgColor, bgColor, m_font };
+    uint32_t bgMask { XCB_GC_FOREGROUND | XCB_GC_BACKGROUND };
+    uint32_t bgValues[] { bgColor, bgColor };
+    xcb_change_gc(m_connection, m_fgGc, fgMask, fgValues);
+    xcb_change_gc(m_connection, m_bgGc, bgMask, bgValues);
+
     return true;
 }
 
 bool
-X11XCB::grabKeyboard()
-{
-    struct timespec req;
-    req.tv_sec = 0;
-    req.tv_nsec = 5000000;
-    unsigned long maxwait { 3000000000UL }; /* 3 seconds */
-    unsigned int i;
-
-    /* this loop is required since pwm grabs the keyboard during the event loop */
-    for (i = 0; i < (maxwait / req.tv_nsec); i++) {
-        nanosleep(&req, NULL);
-        auto cookie = xcb_grab_keyboard(m_connection, 1, m_win, XCB_CURRENT_TIME, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
-        auto reply = xcb_grab_keyboard_reply(m_connection, cookie, NULL);
-        if (reply && reply->status == XCB_GRAB_STATUS_SUCCESS) {
-            free(reply);
-            xcb_set_input_focus(m_connection, XCB_INPUT_FOCUS_PARENT, m_win, XCB_CURRENT_TIME);
-            return true;
+X11XCB::antialiased()
+{
+    return m_render;
+}
+
+void
+X11XCB::requestGrab()
+{
+    m_grabCookie = xcb_grab_keyboard(m_connection, 1, m_win, XCB_CURRENT_TIME, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+    m_grabPending = true;
+    xcb_flush(m_connection);
+}
+
+/*
+ * The answer to the last grab request, without blocking. A grab can fail
+ * because another client, usually the window manager, holds the keyboard
+ * for a while: retrying is up to the caller.
+ */
+X11Interface::GrabStatus
+X11XCB::grabStatus()
+{
+    if (!m_grabPending) {
+        return Grab_Failed;
+    }
+
+    void * reply { nullptr };
+    xcb_generic_error_t * err { nullptr };
+    if (!xcb_poll_for_reply(m_connection, m_grabCookie.sequence, &reply, &err)) {
+        return Grab_Pending;
+    }
+    m_grabPending = false;
+    TRACE_ROUNDTRIP();
+
+    auto grabReply = static_cast<xcb_grab_keyboard_reply_t *>(reply);
+    bool ok { grabReply && grabReply->status == XCB_GRAB_STATUS_SUCCESS };
+    free(reply);
+    free(err);
+    if (!ok) {
+        return Grab_Failed;
+    }
+
+    xcb_set_input_focus(m_connection, XCB_INPUT_FOCUS_PARENT, m_win, XCB_CURRENT_TIME);
+    xcb_flush(m_connection);
+    return Grab_Success;
+}
+
+bool
+X11XCB::grabHotkey(uint16_t keysym, uint16_t modifiers)
+{
+    m_hotkeySym = keysym;
+    m_hotkeyMods = modifiers;
+    auto cookies = grabKeys(true);
+
+    /* somebody else has it */
+    TRACE_ROUNDTRIP();
+    bool ok { !cookies.empty() };
+    for (auto c : cookies) {
+        if (auto err = xcb_request_check(m_connection, c)) {
+            free(err);
+            ok = false;
         }
     }
 
-    return false;
+    return ok;
+}
+
+/*
+ * Grab the hotkey on every keycode giving its keysym, whatever the state
+ * of Caps Lock and Num Lock.
+ */
+vector<xcb_void_cookie_t>
+X11XCB::grabKeys(bool checked)
+{
+    m_hotkeyCodes = m_keymap.keycodes(m_hotkeySym);
+
+    uint16_t numLock { m_keymap.numLockMask() };
+    const uint16_t locks[] { 0, XCB_MOD_MASK_LOCK, numLock, uint16_t(XCB_MOD_MASK_LOCK | numLock) };
+    vector<xcb_void_cookie_t> cookies;
+    for (auto k : m_hotkeyCodes) {
+        for (size_t l = 0; l < (numLock ? 4 : 2); ++l) {
+            auto grab = checked ? xcb_grab_key_checked : xcb_grab_key;
+            cookies.push_back(grab(m_connection, 1, m_screen->root, m_hotkeyMods | locks[l], k,
+                        XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC));
+        }
+    }
+    return cookies;
 }
 
+/*
+ * Whether a key press is the hotkey, which comes to the window while it
+ * has the keyboard.
+ */
 bool
-X11XCB::redraw(const string& command, string::size_type cursorPos)
+X11XCB::isHotkey(const xcb_key_press_event_t * ev) const
 {
-    /* draw the background rectangle */
-    xcb_rectangle_t extRect { 0, 0, m_width, m_height };
-    auto bgCookie = xcb_poly_fill_rectangle_checked(m_connection, m_win, m_bgGc, 1, &extRect);
+    uint16_t locks { uint16_t(XCB_MOD_MASK_LOCK | m_keymap.numLockMask()) };
+    return m_hotkeySym && (ev->state & ~locks & 0xff) == m_hotkeyMods &&
+           find(m_hotkeyCodes.begin(), m_hotkeyCodes.end(), ev->detail) != m_hotkeyCodes.end();
+}
 
-    /* draw the foreground rectangle */
-    uint16_t w = m_width - 1;
-    uint16_t h = m_height - 1;
-    xcb_rectangle_t intRect { 0, 0, w, h };
-    auto fgCookie = xcb_poly_rectangle_checked(m_connection, m_win, m_fgGc, 1, &intRect);
+/*
+ * Add the columns from x0 to x1 inside the border to the damage.
+ */
+void
+X11XCB::damageSpan(vector<xcb_rectangle_t>& damage, int x0, int x1) const
+{
+    x0 = max(x0, 1);
+    x1 = min(x1, m_width - 1);
+    if (x1 > x0) {
+        damage.push_back({ int16_t(x0), 1, uint16_t(x1 - x0), uint16_t(m_height - 2) });
+    }
+}
+
+/*
+ * Draw into the back buffer what changed since the last frame, and copy
+ * that to the window: the text from the first character that changed, the
+ * old and the new cursor, and the status. The text is measured with the
+ * glyph widths known since setupGC(), and nothing is checked, so drawing
+ * never waits for the server.
+ */
+bool
+X11XCB::redraw(const string& command, string::size_type cursorPos, const string& status)
+{
+    TRACE_PHASE("draw");
+
+    m_frameBytes = 0;
+    drawList();
 
     /* get text size */
-    auto wholeExt = getTextExtent(command, command.size());
-    auto partialExt = getTextExtent(command, cursorPos);
+    size_t oldSize { m_text.size() };
+    int oldEnd { m_textOffsets.empty() ? 0 : m_textOffsets.back() };
+    size_t common { layoutText(command) };
+    int newEnd { m_textOffsets.back() };
 
-    /* draw the text */
     int16_t textX = 2;
-    int16_t textY = m_height / 2 + wholeExt->font_ascent / 2;
-    auto txtCookie = xcb_image_text_8_checked(m_connection, command.size(), m_win, m_fgGc,
-        textX, textY, command.c_str());
+    int16_t textY = m_height / 2 + m_fontInfo.ascent / 2;
+    int16_t cursorX = textX + m_textOffsets[min(cursorPos, command.size())];
+    int16_t statusX = m_width - textWidth(status) - 4;
+
+    /* figure out what changed */
+    vector<xcb_rectangle_t> damage;
+    if (!m_painted) {
+        damage.push_back({ 0, 0, m_width, m_height });
+    } else {
+        if (common < max(oldSize, command.size())) {
+            damageSpan(damage, textX + m_textOffsets[common], textX + max(oldEnd, newEnd));
+        }
+        if (cursorX != m_cursorX) {
+            damageSpan(damage, m_cursorX, m_cursorX + 1);
+            damageSpan(damage, cursorX, cursorX + 1);
+        }
+        if (status != m_status) {
+            damageSpan(damage, min(statusX, m_statusX), m_width - 1);
+        }
+    }
+    if (damage.empty()) {
+        xcb_flush(m_connection);
+        return xcb_connection_has_error(m_connection) == 0;
+    }
+
+    /* merge the spans that touch */
+    sort(damage.begin(), damage.end(), [](const auto& a, const auto& b) { return a.x < b.x; });
+    size_t n { 0 };
+    for (size_t i = 1; i < damage.size(); ++i) {
+        auto& last = damage[n];
+        if (damage[i].x <= last.x + last.width) {
+            last.width = max(last.x + last.width, damage[i].x + damage[i].width) - last.x;
+        } else {
+            damage[++n] = damage[i];
+        }
+    }
+    damage.resize(n + 1);
+    int16_t damageX0 { damage.front().x };
+    int damageX1 { damage.back().x + damage.back().width };
+
+    /* clear the damage: whatever is drawn over it below is drawn the same
+     * way outside of it, so there's no need for clipping, except for the
+     * anti-aliased glyphs blending into what's under them */
+    xcb_poly_fill_rectangle(m_connection, m_buffer, m_bgGc, damage.size(), damage.data());
+    m_frameBytes += 12 + 8 * damage.size();
+#ifdef THINGYLAUNCH_RENDER
+    if (m_render) {
+        xcb_render_set_picture_clip_rectangles(m_connection, m_picture, 0, 0, damage.size(), damage.data());
+        m_frameBytes += 12 + 8 * damage.size();
+    }
+#endif
+
+    /* draw the foreground rectangle */
+    if (!m_painted) {
+        uint16_t w = m_width - 1;
+        uint16_t h = m_height - 1;
+        xcb_rectangle_t intRect { 0, 0, w, h };
+        xcb_poly_rectangle(m_connection, m_buffer, m_fgGc, 1, &intRect);
+        m_frameBytes += 12 + 8;
+    }
+
+    /* draw the text, from the first character reaching into the damage;
+     * a glyph can stick out of its cell, so from the one before that with
+     * anti-aliased text */
+    size_t first = upper_bound(m_textOffsets.begin() + 1, m_textOffsets.end(), damageX0 - textX) - (m_textOffsets.begin() + 1);
+    if (m_render && first > 0) {
+        while (--first > 0 && (command[first] & 0xc0) == 0x80) { }
+    }
+    drawText(m_buffer, false, command, first, textX + m_textOffsets[first], textY);
 
     /* draw the cursor */
-    int16_t cursorX = partialExt->overall_width + 2;
-    int16_t cursorY = textY - wholeExt->font_ascent;
-    uint16_t cursorHeight = wholeExt->font_ascent + wholeExt->font_descent;
+    int16_t cursorY = textY - m_fontInfo.ascent;
+    uint16_t cursorHeight = m_fontInfo.ascent + m_fontInfo.descent;
     xcb_rectangle_t curRect = { cursorX, cursorY, 1, cursorHeight };
-    auto curCookie = xcb_poly_fill_rectangle_checked(m_connection, m_win, m_fgGc, 1, &curRect);
+    xcb_poly_fill_rectangle(m_connection, m_buffer, m_fgGc, 1, &curRect);
+    m_frameBytes += 12 + 8;
 
-    free(wholeExt);
-    free(partialExt);
+    /* draw the status, right-aligned, if it's damaged or drawn over */
+    if (!status.empty() && (damageX1 > statusX || textX + newEnd > statusX)) {
+        drawText(m_buffer, false, status, 0, statusX, textY);
+    }
 
-    if (xcb_request_check(m_connection, bgCookie)) {
-        return false;
+    /* show it, in one go: around the damage, nothing changed */
+    int16_t damageY0 { damage.front().y };
+    uint16_t damageHeight { damage.front().height };
+    xcb_copy_area(m_connection, m_buffer, m_win, m_bgGc, damageX0, damageY0, damageX0, damageY0,
+            damageX1 - damageX0, damageHeight);
+    m_frameBytes += 28;
+    xcb_flush(m_connection);
+
+    m_painted = true;
+    m_cursorX = cursorX;
+    m_statusX = statusX;
+    m_status = status;
+
+    return xcb_connection_has_error(m_connection) == 0;
+}
+
+void
+X11XCB::setList(const vector<string>& rows, size_t top, size_t selected)
+{
+    m_rows.assign(rows.begin(), rows.begin() + min(rows.size(), size_t(m_listRows)));
+    m_rowsTop = top;
+    m_rowsSelected = selected;
+}
+
+/*
+ * The back buffer of the list, tall enough for all its rows and its
+ * bottom border, and what draws the selected row.
+ */
+void
+X11XCB::createList()
+{
+    m_rowHeight = m_fontInfo.ascent + m_fontInfo.descent + 2;
+    m_listBuffer = xcb_generate_id(m_connection);
+    xcb_create_pixmap(m_connection, m_screen->root_depth, m_listBuffer, m_win, m_width,
+            m_listRows * m_rowHeight + 1);
+
+    uint32_t selMask { XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | (m_render ? 0u : XCB_GC_FONT) };
+    uint32_t selValues[] { m_bgPixel, m_fgPixel, m_font };
+    m_selGc = xcb_generate_id(m_connection);
+    xcb_create_gc(m_connection, m_selGc, m_win, selMask, selValues);
+
+#ifdef THINGYLAUNCH_RENDER
+    if (m_render) {
+        m_listPicture = xcb_generate_id(m_connection);
+        xcb_render_create_picture(m_connection, m_listPicture, m_listBuffer, m_visualFormat, 0, nullptr);
+        m_bgPicture = xcb_generate_id(m_connection);
+        xcb_render_create_solid_fill(m_connection, m_bgPicture, { m_bgRgb.red, m_bgRgb.green, m_bgRgb.blue, 0xffff });
     }
-    if (xcb_request_check(m_connection, fgCookie)) {
-        return false;
+#endif
+}
+
+/*
+ * Draw the rows of the list that changed, and copy them to the window.
+ * When the list scrolls, the rows still shown are moved within the back
+ * buffer instead of being drawn again. The window grows or shrinks to fit
+ * the rows.
+ */
+void
+X11XCB::drawList()
+{
+    size_t count { m_rows.size() };
+    size_t drawnCount { m_drawnRows.size() };
+    if (count == 0 && drawnCount == 0) {
+        return;
     }
-    if (xcb_request_check(m_connection, txtCookie)) {
-        return false;
+    if (m_listBuffer == XCB_NONE) {
+        createList();
     }
-    if (xcb_request_check(m_connection, curCookie)) {
-        return false;
+
+    /* what changed, in the back buffer */
+    int damageY0 { m_listRows * m_rowHeight + 1 };
+    int damageY1 { 0 };
+
+    /* scroll: row i now shows what row i + shift did */
+    long shift { long(m_rowsTop) - long(m_drawnTop) };
+    if (shift != 0) {
+        long from { max(0L, -shift) };
+        long to { min(long(count), long(drawnCount) - shift) };
+        vector<Row> moved(count);
+        if (from < to) {
+            int16_t srcY = (from + shift) * m_rowHeight;
+            int16_t dstY = from * m_rowHeight;
+            uint16_t height = (to - from) * m_rowHeight;
+            xcb_copy_area(m_connection, m_listBuffer, m_listBuffer, m_bgGc, 0, srcY, 0, dstY, m_width, height);
+            m_frameBytes += 28;
+            for (long i = from; i < to; ++i) {
+                moved[i] = move(m_drawnRows[i + shift]);
+            }
+            damageY0 = min(damageY0, int(dstY));
+            damageY1 = max(damageY1, dstY + height);
+        }
+        m_drawnRows = move(moved);
+    }
+    m_drawnRows.resize(count);
+    m_drawnTop = m_rowsTop;
+
+    for (size_t i = 0; i < count; ++i) {
+        bool selected { m_rowsTop + i == m_rowsSelected };
+        auto& row = m_drawnRows[i];
+        if (row.valid && row.selected == selected && row.text == m_rows[i]) {
+            continue;
+        }
+        drawRow(i, m_rows[i], selected);
+        row.text = m_rows[i];
+        row.selected = selected;
+        row.valid = true;
+        damageY0 = min(damageY0, int(i * m_rowHeight));
+        damageY1 = max(damageY1, int((i + 1) * m_rowHeight));
+    }
+
+    /* the bottom border, and the window fitting the rows */
+    if (count != drawnCount) {
+        if (count > 0) {
+            xcb_rectangle_t border { 0, int16_t(count * m_rowHeight), m_width, 1 };
+            xcb_poly_fill_rectangle(m_connection, m_listBuffer, m_fgGc, 1, &border);
+            m_frameBytes += 12 + 8;
+            damageY0 = min(damageY0, int(border.y));
+            damageY1 = max(damageY1, border.y + 1);
+        }
+        m_windowHeight = m_height + (count > 0 ? count * m_rowHeight + 1 : 0);
+        uint32_t height { m_windowHeight };
+        xcb_configure_window(m_connection, m_win, XCB_CONFIG_WINDOW_HEIGHT, &height);
+        setSizeHints();
+        m_frameBytes += 16 + 24 + sizeof(xcb_size_hints_t);
+    }
+
+    if (damageY0 < damageY1) {
+        xcb_copy_area(m_connection, m_listBuffer, m_win, m_bgGc, 0, damageY0, 0, m_height + damageY0,
+                m_width, damageY1 - damageY0);
+        m_frameBytes += 28;
+    }
+}
+
+/*
+ * Draw a row of the list into its back buffer: the selected row in the
+ * foreground color, the others framed by the window border.
+ */
+void
+X11XCB::drawRow(size_t slot, const string& text, bool selected)
+{
+    int16_t y = slot * m_rowHeight;
+    xcb_rectangle_t frame { 0, y, m_width, m_rowHeight };
+    xcb_poly_fill_rectangle(m_connection, m_listBuffer, m_fgGc, 1, &frame);
+    m_frameBytes += 12 + 8;
+
+    xcb_rectangle_t inside { 1, y, uint16_t(m_width - 2), m_rowHeight };
+    if (!selected) {
+        xcb_poly_fill_rectangle(m_connection, m_listBuffer, m_bgGc, 1, &inside);
+        m_frameBytes += 12 + 8;
+    }
+
+#ifdef THINGYLAUNCH_RENDER
+    if (m_render) {
+        xcb_render_set_picture_clip_rectangles(m_connection, m_listPicture, 0, 0, 1, &inside);
+        m_frameBytes += 12 + 8;
     }
+#endif
+
+    drawText(m_listBuffer, selected, text, 0, 2, y + 1 + m_fontInfo.ascent);
+}
+
+/*
+ * The size of the requests the last redraw() sent.
+ */
+size_t
+X11XCB::frameBytes()
+{
+    return m_frameBytes;
+}
 
+void
+X11XCB::wakeup()
+{
+    xcb_client_message_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.response_type = XCB_CLIENT_MESSAGE;
+    ev.format = 32;
+    ev.window = m_win;
+    ev.type = XCB_ATOM_NONE;
+
+    xcb_send_event(m_connection, 0, m_win, XCB_EVENT_MASK_NO_EVENT, reinterpret_cast<const char *>(&ev));
     xcb_flush(m_connection);
+}
 
-    return true;
+int
+X11XCB::fd()
+{
+    return xcb_get_file_descriptor(m_connection);
 }
 
 bool
-X11XCB::nextEvent(X11Event& event)
+X11XCB::connected()
+{
+    return xcb_connection_has_error(m_connection) == 0;
+}
+
+bool
+X11XCB::pollEvent(X11Event& event, bool read)
 {
     xcb_generic_event_t * e;
     xcb_key_press_event_t * kev;
+    xcb_expose_event_t * eev;
 
     event.type = X11Event::EventType::Evt_Other;
+    event.key = 0;
+    event.ch = 0;
 
-    e = xcb_wait_for_event(m_connection);
+    e = read ? xcb_poll_for_event(m_connection) : xcb_poll_for_queued_event(m_connection);
+    if (!e && m_keymapStale) {
+        /* waiting for the mapping may queue more events */
+        refreshKeymap();
+        e = xcb_poll_for_queued_event(m_connection);
+    }
     if (!e) {
         return false;
     }
 
     switch (e->response_type & ~0x80) {
         case XCB_EXPOSE:
+            /* the back buffer has it all */
+            eev = reinterpret_cast<xcb_expose_event_t *>(e);
+            if (m_painted) {
+                int top { eev->y };
+                int bottom { eev->y + eev->height };
+                if (top < m_height) {
+                    xcb_copy_area(m_connection, m_buffer, m_win, m_bgGc, eev->x, top, eev->x, top,
+                            eev->width, min(bottom, int(m_height)) - top);
+                }
+                if (bottom > m_height && m_listBuffer != XCB_NONE) {
+                    top = max(top, int(m_height));
+                    xcb_copy_area(m_connection, m_listBuffer, m_win, m_bgGc, eev->x, top - m_height, eev->x, top,
+                            eev->width, bottom - top);
+                }
+                if (eev->count == 0) {
+                    xcb_flush(m_connection);
+                }
+            }
             event.type = X11Event::EventType::Evt_Expose;
             break;
         case XCB_KEY_PRESS:
+            if (m_keymapStale) {
+                refreshKeymap();
+            }
             kev = reinterpret_cast<xcb_key_press_event_t *>(e);
-            event.type = X11Event::EventType::Evt_KeyPress;
-            event.key = xcb_key_symbols_get_keysym(m_keysyms, kev->detail, 0);
+            event.type = kev->event == m_screen->root || isHotkey(kev) ? X11Event::EventType::Evt_Hotkey
+                                                                       : X11Event::EventType::Evt_KeyPress;
+            {
+                const Keymap::Key& key { m_keymap.translate(kev->detail, kev->state) };
+                event.key = key.keysym;
+                event.ch = key.ch;
+            }
             event.state = kev->state;
             break;
+        case XCB_MAPPING_NOTIFY:
+            /* the mapping is read again once the events that came with
+             * this one are handled */
+            if (reinterpret_cast<xcb_mapping_notify_event_t *>(e)->request != XCB_MAPPING_POINTER) {
+                m_keymapStale = true;
+            }
+            break;
+        case XCB_CLIENT_MESSAGE:
+            event.type = X11Event::EventType::Evt_Wakeup;
+            break;
 
         default:
             break;